@@ -0,0 +1,500 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+    Benchmarks for listen-like itself, results are written as JSON to stdout.
+
+    Usage: listen-like-bench LAUNCHER [DURATION_MS]
+
+    Same binary is started by LAUNCHER as instrumented app:
+        listen-like-bench child accept-once|accept|recv
+*/
+
+#define BENCH_PORT 20000
+#define BENCH_CLIENTS 4
+#define BENCH_DGRAM_SIZE 64
+/*
+    Default Backlog=128 overflows under BENCH_CLIENTS connecting in a loop,
+    then SYN retransmits are measured instead of launcher. Variants with
+    own --Backlog override it.
+*/
+#define BENCH_BACKLOG "--Backlog=4096"
+
+struct variant
+{
+    const char *name;
+    /* stream: count accepted connections, dgram: received datagrams */
+    int socket_type;
+    /* unix socket instead of 127.0.0.1 */
+    int unix_socket;
+    /* extra launcher options, NULL terminated */
+    const char *options[4];
+};
+
+static const struct variant variants[] = {
+    {"inet-stream", SOCK_STREAM, 0, {NULL}},
+    {"inet-stream-reuseport", SOCK_STREAM, 0, {"--ReusePort", NULL}},
+    {"inet-stream-reuseport-group", SOCK_STREAM, 0, {"--ReusePortGroup=auto", NULL}},
+    {"inet-stream-backlog-16", SOCK_STREAM, 0, {"--Backlog=16", NULL}},
+    {"inet-stream-backlog-128", SOCK_STREAM, 0, {"--Backlog=128", NULL}},
+    {"unix-stream", SOCK_STREAM, 1, {NULL}},
+    {"inet-dgram", SOCK_DGRAM, 0, {NULL}},
+    {"inet-dgram-reuseport-group", SOCK_DGRAM, 0, {"--ReusePortGroup=auto", NULL}},
+    {"unix-dgram", SOCK_DGRAM, 1, {NULL}},
+};
+
+static const int activation_sizes[] = {1, 10, 100, 1000, 10000};
+
+/* child */
+static int child_main(const char *mode);
+static void *child_worker(void *arg);
+
+/* driver */
+static int64_t monotonic_ns(void);
+static pid_t launcher_start(char *const launcher_argv[], int *stdout_fd);
+static int bench_activation(const char *launcher, const char *self, int listeners, int64_t *child_start_ns, int64_t *first_accept_ns);
+static int bench_throughput(const char *launcher, const char *self, const struct variant *v, uint32_t duration_ms, uint64_t *ops);
+static void client_run(const struct variant *v, const struct sockaddr_storage *addr, socklen_t addr_len, int64_t deadline);
+static int wait_connectable(const struct variant *v, const struct sockaddr_storage *addr, socklen_t addr_len);
+
+/* child impl */
+
+static uint64_t child_counter;
+static const char *child_mode;
+
+static int child_main(const char *mode)
+{
+    const int64_t started = monotonic_ns();
+    const char *listen_fds = getenv("LISTEN_FDS");
+    const int fds = listen_fds ? atoi(listen_fds) : 0;
+    if (fds < 1)
+    {
+        fprintf(stderr, "no LISTEN_FDS\n");
+        return 1;
+    }
+
+    if (strcmp(mode, "accept-once") == 0)
+    {
+        int conn = accept(3, NULL, NULL);
+        if (conn < 0)
+        {
+            perror("accept");
+            return 1;
+        }
+        /* let driver know when we were started */
+        if (write(conn, &started, sizeof(started)) != sizeof(started))
+        {
+            return 1;
+        }
+        close(conn);
+        return 0;
+    }
+
+    child_mode = mode;
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    /* one thread per descriptor, so SO_REUSEPORT groups are used in parallel */
+    for (intptr_t fd = 3; fd < 3 + fds; ++fd)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, child_worker, (void *)fd))
+        {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+
+    int sig = 0;
+    sigwait(&mask, &sig);
+    printf("%llu\n", (unsigned long long)__atomic_load_n(&child_counter, __ATOMIC_RELAXED));
+    fflush(stdout);
+    _exit(0);
+}
+
+static void *child_worker(void *arg)
+{
+    const int fd = (int)(intptr_t)arg;
+    const int accepting = strcmp(child_mode, "accept") == 0;
+    char buf[BENCH_DGRAM_SIZE];
+
+    for (;;)
+    {
+        if (accepting)
+        {
+            int conn = accept(fd, NULL, NULL);
+            if (conn < 0)
+            {
+                continue;
+            }
+            close(conn);
+        }
+        else if (recv(fd, buf, sizeof(buf), 0) < 0)
+        {
+            continue;
+        }
+        __atomic_add_fetch(&child_counter, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/* driver impl */
+
+static int64_t monotonic_ns(void)
+{
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static pid_t launcher_start(char *const launcher_argv[], int *stdout_fd)
+{
+    int out[2];
+    if (pipe2(out, O_CLOEXEC))
+    {
+        perror("pipe");
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        /* launcher is chatty on stderr, results go to stdout */
+        int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        dup2(null, STDERR_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        execv(launcher_argv[0], launcher_argv);
+        _exit(127);
+    }
+
+    close(out[1]);
+    *stdout_fd = out[0];
+    return pid;
+}
+
+static int bench_activation(const char *launcher, const char *self, int listeners, int64_t *child_start_ns, int64_t *first_accept_ns)
+{
+    char **argv = calloc(listeners + 8, sizeof(char *));
+    int argc = 0;
+    argv[argc++] = (char *)launcher;
+    argv[argc++] = "--ReuseAddress";
+    for (int i = 0; i < listeners; ++i)
+    {
+        if (asprintf(&argv[argc++], "--ListenStream=127.0.0.1:%d", BENCH_PORT + i) < 0)
+        {
+            return 1;
+        }
+    }
+    argv[argc++] = "--";
+    argv[argc++] = (char *)self;
+    argv[argc++] = "child";
+    argv[argc++] = "accept-once";
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(BENCH_PORT),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+
+    int out = -1;
+    const int64_t started = monotonic_ns();
+    pid_t pid = launcher_start(argv, &out);
+    if (pid < 0)
+    {
+        return 1;
+    }
+
+    int ret = 1;
+    for (;;)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+        {
+            int64_t child_started = 0;
+            if (read(fd, &child_started, sizeof(child_started)) == sizeof(child_started))
+            {
+                *first_accept_ns = monotonic_ns() - started;
+                *child_start_ns = child_started - started;
+                ret = 0;
+            }
+            close(fd);
+            break;
+        }
+        close(fd);
+
+        if (errno != ECONNREFUSED || waitpid(pid, NULL, WNOHANG) == pid)
+        {
+            perror("connect");
+            break;
+        }
+        usleep(100);
+    }
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    close(out);
+
+    for (int i = 0; i < listeners; ++i)
+    {
+        free(argv[2 + i]);
+    }
+    free(argv);
+    return ret;
+}
+
+static int wait_connectable(const struct variant *v, const struct sockaddr_storage *addr, socklen_t addr_len)
+{
+    if (v->socket_type == SOCK_DGRAM)
+    {
+        /* nothing to probe, give launcher a moment to bind */
+        usleep(200000);
+        return 0;
+    }
+
+    for (int i = 0; i < 10000; ++i)
+    {
+        int fd = socket(addr->ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int ret = connect(fd, (const struct sockaddr *)addr, addr_len);
+        close(fd);
+        if (ret == 0)
+        {
+            return 0;
+        }
+        usleep(1000);
+    }
+    return 1;
+}
+
+static void client_run(const struct variant *v, const struct sockaddr_storage *addr, socklen_t addr_len, int64_t deadline)
+{
+    char buf[BENCH_DGRAM_SIZE] = {0};
+    int fd = -1;
+
+    if (v->socket_type == SOCK_DGRAM)
+    {
+        fd = socket(addr->ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (connect(fd, (const struct sockaddr *)addr, addr_len))
+        {
+            perror("connect");
+            _exit(1);
+        }
+    }
+
+    while (monotonic_ns() < deadline)
+    {
+        if (v->socket_type == SOCK_DGRAM)
+        {
+            for (int i = 0; i < 64; ++i)
+            {
+                /* ENOBUFS/EAGAIN: receiver is behind, that is what we measure */
+                send(fd, buf, sizeof(buf), MSG_DONTWAIT);
+            }
+            continue;
+        }
+
+        fd = socket(addr->ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        /* RST on close, TIME_WAIT would eat all ephemeral ports */
+        struct linger linger = {.l_onoff = 1, .l_linger = 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+        connect(fd, (const struct sockaddr *)addr, addr_len);
+        close(fd);
+    }
+    _exit(0);
+}
+
+static int bench_throughput(const char *launcher, const char *self, const struct variant *v, uint32_t duration_ms, uint64_t *ops)
+{
+    char tmp_dir[] = "/tmp/listen-like-bench-XXXXXX";
+    struct sockaddr_storage addr = {0};
+    socklen_t addr_len = 0;
+    char listen_arg[PATH_MAX];
+
+    if (v->unix_socket)
+    {
+        if (mkdtemp(tmp_dir) == NULL)
+        {
+            perror("mkdtemp");
+            return 1;
+        }
+        struct sockaddr_un *un = (struct sockaddr_un *)&addr;
+        un->sun_family = AF_UNIX;
+        snprintf(un->sun_path, sizeof(un->sun_path), "%s/socket", tmp_dir); /* NOLINT */
+        addr_len = sizeof(*un);
+        snprintf(listen_arg, sizeof(listen_arg), "--%s=%s", /* NOLINT */
+            v->socket_type == SOCK_DGRAM ? "ListenDatagram" : "ListenStream", un->sun_path);
+    }
+    else
+    {
+        struct sockaddr_in *in = (struct sockaddr_in *)&addr;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(BENCH_PORT);
+        in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr_len = sizeof(*in);
+        snprintf(listen_arg, sizeof(listen_arg), "--%s=127.0.0.1:%d", /* NOLINT */
+            v->socket_type == SOCK_DGRAM ? "ListenDatagram" : "ListenStream", BENCH_PORT);
+    }
+
+    char *argv[16] = {0};
+    int argc = 0;
+    argv[argc++] = (char *)launcher;
+    argv[argc++] = "--ReuseAddress";
+    argv[argc++] = BENCH_BACKLOG;
+    for (int i = 0; v->options[i]; ++i)
+    {
+        argv[argc++] = (char *)v->options[i];
+    }
+    argv[argc++] = listen_arg;
+    argv[argc++] = "--";
+    argv[argc++] = (char *)self;
+    argv[argc++] = "child";
+    argv[argc++] = v->socket_type == SOCK_DGRAM ? "recv" : "accept";
+
+    int out = -1;
+    pid_t pid = launcher_start(argv, &out);
+    if (pid < 0 || wait_connectable(v, &addr, addr_len))
+    {
+        fprintf(stderr, "%s: launcher did not come up\n", v->name);
+        return 1;
+    }
+
+    const int64_t deadline = monotonic_ns() + (int64_t)duration_ms * 1000000;
+    pid_t clients[BENCH_CLIENTS];
+    for (int i = 0; i < BENCH_CLIENTS; ++i)
+    {
+        clients[i] = fork();
+        if (clients[i] == 0)
+        {
+            client_run(v, &addr, addr_len, deadline);
+        }
+    }
+    for (int i = 0; i < BENCH_CLIENTS; ++i)
+    {
+        waitpid(clients[i], NULL, 0);
+    }
+
+    kill(pid, SIGTERM);
+    char result[64] = {0};
+    ssize_t n = read(out, result, sizeof(result) - 1);
+    waitpid(pid, NULL, 0);
+    close(out);
+
+    if (v->unix_socket)
+    {
+        unlink(((struct sockaddr_un *)&addr)->sun_path);
+        rmdir(tmp_dir);
+    }
+
+    if (n <= 0)
+    {
+        fprintf(stderr, "%s: no result from app\n", v->name);
+        return 1;
+    }
+    *ops = strtoull(result, NULL, 10);
+    return 0;
+}
+
+/* main */
+
+int main(int argc, char *argv[])
+{
+    if (argc == 3 && strcmp(argv[1], "child") == 0)
+    {
+        return child_main(argv[2]);
+    }
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s LAUNCHER [DURATION_MS]\n", argv[0]);
+        return 1;
+    }
+
+    const char *launcher = argv[1];
+    const uint32_t duration_ms = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 1000;
+
+    char self[PATH_MAX] = {0};
+    if (readlink("/proc/self/exe", self, sizeof(self) - 1) < 0)
+    {
+        perror("readlink");
+        return 1;
+    }
+
+    /* 10k listeners will not fit into default soft limit */
+    struct rlimit limits = {0};
+    getrlimit(RLIMIT_NOFILE, &limits);
+    limits.rlim_cur = limits.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limits);
+
+    int ret = 0;
+    const char *separator = "";
+    printf("{\n  \"duration_ms\": %u,\n  \"activation\": [", duration_ms);
+    for (size_t i = 0; i < sizeof(activation_sizes) / sizeof(activation_sizes[0]); ++i)
+    {
+        const int listeners = activation_sizes[i];
+        if ((rlim_t)listeners + 16 > limits.rlim_cur)
+        {
+            fprintf(stderr, "skipping %d listeners, RLIMIT_NOFILE too low\n", listeners);
+            continue;
+        }
+
+        int64_t child_start_ns = 0;
+        int64_t first_accept_ns = 0;
+        if (bench_activation(launcher, self, listeners, &child_start_ns, &first_accept_ns))
+        {
+            fprintf(stderr, "activation with %d listeners failed\n", listeners);
+            ret = 1;
+            continue;
+        }
+        printf("%s\n    {\"listeners\": %d, \"exec_to_app_start_us\": %.1f, \"exec_to_first_accept_us\": %.1f}",
+            separator, listeners, child_start_ns / 1000.0, first_accept_ns / 1000.0);
+        fflush(stdout);
+        separator = ",";
+    }
+
+    printf("\n  ],\n  \"throughput\": [");
+    separator = "";
+    for (size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); ++i)
+    {
+        const struct variant *v = &variants[i];
+        uint64_t ops = 0;
+        if (bench_throughput(launcher, self, v, duration_ms, &ops))
+        {
+            ret = 1;
+            continue;
+        }
+        printf("%s\n    {\"name\": \"%s\", \"unit\": \"%s\", \"total\": %llu, \"per_sec\": %.0f}",
+            separator, v->name, v->socket_type == SOCK_DGRAM ? "datagrams" : "accepts",
+            (unsigned long long)ops, ops * 1000.0 / duration_ms);
+        fflush(stdout);
+        separator = ",";
+    }
+    printf("\n  ]\n}\n");
+
+    return ret;
+}
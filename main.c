@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <pwd.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -16,9 +17,69 @@
 #include <fcntl.h>
 #include <sys/file.h>
 #include <sys/resource.h>
+#include <dirent.h>
+#include <mqueue.h>
+#include <sched.h>
+#include <linux/sched.h>
 #include <netinet/tcp.h>
 #include <netinet/ip.h>
+#include <netinet/udp.h>
 #include <stdbool.h>
+#include <inttypes.h>
+#include <ctype.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <linux/filter.h>
+#include <linux/net_tstamp.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <sys/uio.h>
+#include <sys/prctl.h>
+#include <poll.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include <linux/unix_diag.h>
+
+/* USDT probes for perf/bpftrace, compiled out without systemtap headers */
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE_PROBE_BEGIN(phase, detail, port) STAP_PROBE3(listen_like, phase__begin, phase, detail, port)
+#define TRACE_PROBE_END(phase, detail, port) STAP_PROBE3(listen_like, phase__end, phase, detail, port)
+#endif
+#endif
+#ifndef TRACE_PROBE_BEGIN
+#define TRACE_PROBE_BEGIN(phase, detail, port) do { (void)(phase); (void)(detail); (void)(port); } while (0)
+#define TRACE_PROBE_END(phase, detail, port) do { (void)(phase); (void)(detail); (void)(port); } while (0)
+#endif
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+/* 6.18+, THP only where madvise(MADV_HUGEPAGE) asked for it */
+#ifndef PR_THP_DISABLE_EXCEPT_ADVISED
+#define PR_THP_DISABLE_EXCEPT_ADVISED (1 << 1)
+#endif
+
+/* linux/mempolicy.h, not in every libc */
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
 
 #ifndef APP_VERSION
 #define APP_VERSION "unknown"
@@ -63,6 +124,75 @@ enum
     ARG_REUSE_PORT,
     ARG_REUSE_ADDR,
     ARG_IP_DSCP,
+    ARG_REUSE_PORT_GROUP,
+    ARG_FD_NAME,
+    ARG_ON_DEMAND,
+    ARG_IDLE_EXIT_SEC,
+    ARG_ACCEPT,
+    ARG_MAX_CONNECTIONS,
+    ARG_SPAWN_POOL,
+    ARG_SUPERVISE,
+    ARG_RESTART_SEC,
+    ARG_RESTART_MAX_DELAY_SEC,
+    ARG_TYPE,
+    ARG_TIMEOUT_START_SEC,
+    ARG_DEFER_ACCEPT_SEC,
+    ARG_FAST_OPEN,
+    ARG_FAST_OPEN_KEY,
+    ARG_BUSY_POLL_USEC,
+    ARG_PREFER_BUSY_POLL,
+    ARG_BUSY_POLL_BUDGET,
+    ARG_INCOMING_CPU,
+    ARG_UDP_GRO,
+    ARG_UDP_SEGMENT,
+    ARG_RECEIVE_QUEUE_OVERFLOW,
+    ARG_BUFFER_FORCE,
+    ARG_LISTEN_XDP,
+    ARG_XDP_FRAME_SIZE,
+    ARG_XDP_FRAME_COUNT,
+    ARG_XDP_RING_SIZE,
+    ARG_XDP_MODE,
+    ARG_METRICS_SOCKET,
+    ARG_METRICS_FILE,
+    ARG_METRICS_INTERVAL_SEC,
+    ARG_LIMIT_NOFILE,
+    ARG_LIMIT_MEMLOCK,
+    ARG_CPU_SCHEDULING_POLICY,
+    ARG_CPU_SCHEDULING_PRIORITY,
+    ARG_NICE,
+    ARG_IO_SCHEDULING_CLASS,
+    ARG_IO_SCHEDULING_PRIORITY,
+    ARG_TIMER_SLACK_NSEC,
+    ARG_TRANSPARENT_HUGE_PAGES,
+    ARG_OOM_SCORE_ADJUST,
+    ARG_CONNECT_STREAM,
+    ARG_CONNECT_SOURCE_ADDRESS,
+    ARG_CONNECT_TIMEOUT_SEC,
+    ARG_NO_DELAY,
+    ARG_FILE_DESCRIPTOR_STORE_MAX,
+    ARG_SHARED_MEMORY,
+    ARG_SOCKET_FILTER,
+    ARG_SOCKET_FILTER_BPF,
+    ARG_LISTEN_FIFO,
+    ARG_PIPE_SIZE,
+    ARG_LISTEN_MESSAGE_QUEUE,
+    ARG_MESSAGE_QUEUE_MAX_MESSAGES,
+    ARG_MESSAGE_QUEUE_MESSAGE_SIZE,
+    ARG_TRACE_STARTUP,
+    ARG_FREE_BIND,
+    ARG_TRANSPARENT,
+    ARG_HANDOFF_SOCKET,
+    ARG_INHERIT_FROM,
+    ARG_WORKERS,
+    ARG_TIMESTAMPING,
+    ARG_REUSE_PORT_MIGRATE,
+    ARG_SLICE,
+    ARG_CPU_WEIGHT,
+    ARG_CPU_QUOTA,
+    ARG_MEMORY_HIGH,
+    ARG_MEMORY_MAX,
+    ARG_IO_WEIGHT,
+    ARG_ALLOWED_CPUS,
 };
 struct tos_item
 {
@@ -78,10 +208,101 @@ static struct tos_item tos_items[] = {
     {0},
 };
 
+struct name_value
+{
+    const char *name;
+    const int value;
+};
+
+static const struct name_value sched_policies[] = {
+    {"other", SCHED_OTHER},
+    {"batch", SCHED_BATCH},
+    {"idle", SCHED_IDLE},
+    {"fifo", SCHED_FIFO},
+    {"rr", SCHED_RR},
+    {0},
+};
+
+static const struct name_value io_classes[] = {
+    {"none", 0},
+    {"realtime", 1},
+    {"best-effort", 2},
+    {"idle", 3},
+    {0},
+};
+
+enum
+{
+    /* TransparentHugePages=never, PR_SET_THP_DISABLE */
+    THP_NEVER = 1,
+    /* TransparentHugePages=madvise, PR_THP_DISABLE_EXCEPT_ADVISED */
+    THP_MADVISE,
+};
+
+static const struct name_value thp_modes[] = {
+    {"default", 0},
+    {"never", THP_NEVER},
+    {"madvise", THP_MADVISE},
+    {0},
+};
+
+/* Timestamping, generation flags come with their reporting flag */
+static const struct name_value timestamping_flags[] = {
+    {"software", SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE},
+    {"rx-sw", SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE},
+    {"tx-sw", SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE},
+    {"tx-sched", SOF_TIMESTAMPING_TX_SCHED | SOF_TIMESTAMPING_SOFTWARE},
+    {"tx-ack", SOF_TIMESTAMPING_TX_ACK | SOF_TIMESTAMPING_SOFTWARE},
+    {"hardware", SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE},
+    {"rx-hw", SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE},
+    {"tx-hw", SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE},
+    {"opt-id", SOF_TIMESTAMPING_OPT_ID},
+    {"opt-tsonly", SOF_TIMESTAMPING_OPT_TSONLY},
+    {"opt-cmsg", SOF_TIMESTAMPING_OPT_CMSG},
+    {"opt-stats", SOF_TIMESTAMPING_OPT_STATS},
+    {"opt-pktinfo", SOF_TIMESTAMPING_OPT_PKTINFO},
+    {"opt-tx-swhw", SOF_TIMESTAMPING_OPT_TX_SWHW},
+    {0},
+};
+
 static struct argp_option args[] = {
-    {"ListenStream", ARG_LISTEN_STREAM, "STREAM"},
-    {"ListenDatagram", ARG_LISTEN_DATAGRAM, "DATAGRAM"},
+    {"ListenStream", ARG_LISTEN_STREAM, "STREAM", 0,
+     "Unix socket path, PORT or HOST:PORT. PORT might be a range FIRST-LAST,"
+     " one listener per port"},
+    {"ListenDatagram", ARG_LISTEN_DATAGRAM, "DATAGRAM", 0, "Same as ListenStream"},
     {"ListenSequentialPacket", ARG_LISTEN_SEQ, "SEQ"},
+    {"ListenFIFO", ARG_LISTEN_FIFO, "PATH", 0,
+     "Named pipe, created with SocketMode, SocketUser and SocketGroup unless"
+     " it exists. Opened read-write and non-blocking."},
+    {"PipeSize", ARG_PIPE_SIZE, "BYTES", 0,
+     "F_SETPIPE_SZ for every ListenFIFO (K, M suffix), above"
+     " /proc/sys/fs/pipe-max-size needs CAP_SYS_RESOURCE"},
+    {"ListenMessageQueue", ARG_LISTEN_MESSAGE_QUEUE, "/NAME", 0,
+     "POSIX message queue, created with SocketMode, SocketUser and SocketGroup"
+     " unless it exists"},
+    {"MessageQueueMaxMessages", ARG_MESSAGE_QUEUE_MAX_MESSAGES, "N", 0,
+     "mq_maxmsg of created ListenMessageQueue, above"
+     " /proc/sys/fs/mqueue/msg_max needs CAP_SYS_RESOURCE"},
+    {"MessageQueueMessageSize", ARG_MESSAGE_QUEUE_MESSAGE_SIZE, "BYTES", 0,
+     "mq_msgsize of created ListenMessageQueue, set together with"
+     " MessageQueueMaxMessages"},
+    {"TraceStartup", ARG_TRACE_STARTUP, "FILE", 0,
+     "Write JSON timeline of launcher startup to FILE: CLOCK_MONOTONIC start"
+     " and duration of every phase, per listener too. Same boundaries are"
+     " USDT probes listen_like:phase__begin/phase__end(phase, detail, port)."},
+    {"ListenXDP", ARG_LISTEN_XDP, "IFNAME:QUEUE:PORT", 0,
+     "AF_XDP socket bound to QUEUE of IFNAME, with UDP (IPv4) traffic for PORT"
+     " redirected to it. XSK, UMEM memfd and XDP link are passed as"
+     " xsk-IFNAME-QUEUE, umem-IFNAME-QUEUE and xdp-IFNAME-QUEUE."
+     " UMEM frame size is exported in $LISTEN_XDP_FRAME_SIZE."},
+    {"XDPFrameSize", ARG_XDP_FRAME_SIZE, "BYTES", 0,
+     "UMEM frame size, power of 2 between 2048 and page size (default: 4096)"},
+    {"XDPFrameCount", ARG_XDP_FRAME_COUNT, "N", 0,
+     "Number of UMEM frames (default: 4096)"},
+    {"XDPRingSize", ARG_XDP_RING_SIZE, "N", 0,
+     "Size of RX, TX, fill and completion rings, power of 2 (default: 2048)"},
+    {"XDPMode", ARG_XDP_MODE, "auto|native|generic", 0,
+     "XDP attach mode, auto tries native driver mode first (default: auto)"},
     {"SocketProtocol", ARG_SOCKET_PROTOCOL, "PROT", 0,
      "Think twice before using it. Most protocol only accept 0 as valid value."
      " Using SocketProtocol might result in hard to debug errors."
@@ -106,11 +327,177 @@ static struct argp_option args[] = {
     {"Priority", ARG_PRIORITY, "PRIORITY"},
     {"ReceiveBuffer", ARG_RECEIVE_BUFFER, "BYTES"},
     {"SendBuffer", ARG_SEND_BUFFER, "BYTES"},
+    {"BufferForce", ARG_BUFFER_FORCE, NULL, 0,
+     "Use SO_RCVBUFFORCE/SO_SNDBUFFORCE for ReceiveBuffer/SendBuffer, so"
+     " net.core.rmem_max/wmem_max do not apply. Needs CAP_NET_ADMIN, falls"
+     " back to regular options without it."},
+    {"UDPGRO", ARG_UDP_GRO, NULL, 0,
+     "UDP_GRO: receive coalesced datagrams on ListenDatagram (udp)"},
+    {"UDPSegment", ARG_UDP_SEGMENT, "SIZE", 0,
+     "UDP_SEGMENT: default GSO segment size for sends on ListenDatagram (udp)"},
+    {"ReceiveQueueOverflow", ARG_RECEIVE_QUEUE_OVERFLOW, NULL, 0,
+     "SO_RXQ_OVFL: report number of dropped datagrams with every receive"},
+    {"Timestamping", ARG_TIMESTAMPING, "FLAGS", 0,
+     "SO_TIMESTAMPING: comma separated software, rx-sw, tx-sw, tx-sched,"
+     " tx-ack, hardware, rx-hw, tx-hw, opt-id, opt-tsonly, opt-cmsg,"
+     " opt-stats, opt-pktinfo, opt-tx-swhw; ns for SO_TIMESTAMPNS."
+     " Hardware ones need NIC configured with SIOCSHWTSTAMP. opt-id is"
+     " skipped on TCP, kernel takes it on connected sockets only."},
     {"IPTTL", ARG_IP_TTL, "TTL"},
     {"IPTOS", ARG_IP_TOS, "TOS", 0, "Deprecated. Use --IPDSCP."},
     {"IPDSCP", ARG_IP_DSCP, "DSCP"},
     {"ReusePort", ARG_REUSE_PORT},
+    {"BusyPollUsec", ARG_BUSY_POLL_USEC, "USEC", 0,
+     "SO_BUSY_POLL: busy poll device queue for USEC on blocking receive"},
+    {"PreferBusyPoll", ARG_PREFER_BUSY_POLL, NULL, 0,
+     "SO_PREFER_BUSY_POLL: prefer busy polling over softirq processing"},
+    {"BusyPollBudget", ARG_BUSY_POLL_BUDGET, "N", 0,
+     "SO_BUSY_POLL_BUDGET: packets processed per busy poll"},
+    {"IncomingCPU", ARG_INCOMING_CPU, "CPU", 0,
+     "SO_INCOMING_CPU: prefer this listener for flows processed on CPU."
+     " NAPI ID of every inet listener is printed on startup."},
+    {"DeferAcceptSec", ARG_DEFER_ACCEPT_SEC, "SEC", 0,
+     "TCP_DEFER_ACCEPT: wake app up only when data arrived on connection"},
+    {"FastOpen", ARG_FAST_OPEN, "QLEN", 0,
+     "TCP_FASTOPEN: enable TCP Fast Open with QLEN pending requests"},
+    {"FastOpenKey", ARG_FAST_OPEN_KEY, "FILE", 0,
+     "TCP_FASTOPEN_KEY: load key in /proc/sys/net/ipv4/tcp_fastopen_key format"
+     " (primary[,backup]). Resident modes load it again on SIGHUP."},
+    {"SocketFilter", ARG_SOCKET_FILTER, "FILE", 0,
+     "SO_ATTACH_FILTER: classic BPF program in tcpdump -ddd format, packets"
+     " it rejects are dropped before they are queued. Locked with"
+     " SO_LOCK_FILTER, so app can not detach it."},
+    {"SocketFilterBPF", ARG_SOCKET_FILTER_BPF, "PINNED", 0,
+     "SO_ATTACH_BPF: same with eBPF socket filter program pinned in bpffs at"
+     " PINNED, eg. /sys/fs/bpf/drop_junk"},
     {"ReuseAddress", ARG_REUSE_ADDR},
+    {"Workers", ARG_WORKERS, "N|auto", 0,
+     "Stay resident and run N apps (auto: one per CPU) sharing same listeners,"
+     " each pinned to its own slice of CPUs and preferring memory of their"
+     " NUMA node. Index is in $LISTEN_WORKER_INDEX. Crashed workers are"
+     " restarted as with --Supervise, SIGHUP restarts all of them."},
+    {"HandoffSocket", ARG_HANDOFF_SOCKET, "PATH", 0,
+     "With --Supervise, --OnDemand or --Accept: hand bound listeners over to"
+     " new listen-like connecting to unix socket PATH (same user only), see"
+     " --InheritFrom"},
+    {"InheritFrom", ARG_INHERIT_FROM, "PATH", 0,
+     "Adopt listeners served on HandoffSocket PATH by running listen-like"
+     " instead of creating them, matched by name and family/type/protocol."
+     " Accept queues survive. Missing PATH: create everything as usual."},
+    {"FreeBind", ARG_FREE_BIND, NULL, 0,
+     "IP_FREEBIND/IPV6_FREEBIND: bind to address not configured (yet), eg."
+     " VIP that moves here on failover"},
+    {"Transparent", ARG_TRANSPARENT, NULL, 0,
+     "IP_TRANSPARENT/IPV6_TRANSPARENT: bind to any address, for TPROXY."
+     " Needs CAP_NET_ADMIN."},
+    {"ReusePortGroup", ARG_REUSE_PORT_GROUP, "N", 0,
+     "Create N sockets (or 'auto' for one per online CPU) for every inet"
+     " ListenStream/ListenDatagram, joined into single SO_REUSEPORT group."
+     " Incoming flows are steered to socket of the CPU that received them."},
+    {"ReusePortMigrate", ARG_REUSE_PORT_MIGRATE, NULL, 0,
+     "SO_REUSEPORT, and when socket of TCP group is closed (eg. by app"
+     " restarted elsewhere), move its queued and half-open connections to"
+     " remaining sockets instead of resetting them. Uses sk_reuseport BPF"
+     " program, or net.ipv4.tcp_migrate_req with ReusePortGroup or without"
+     " CAP_BPF."},
+    {"FileDescriptorName", ARG_FD_NAME, "NAME", 0,
+     "Name reported for every listener in $LISTEN_FDNAMES (default: unknown)"},
+    {"OnDemand", ARG_ON_DEMAND, NULL, 0,
+     "Stay resident and start APP_TO_RUN only when first connection or"
+     " datagram arrives. When app exits, wait for next one."},
+    {"IdleExitSec", ARG_IDLE_EXIT_SEC, "SEC", 0,
+     "With --OnDemand: send SIGTERM to app when no new connection or datagram"
+     " arrived for SEC seconds. Queued ones will start it again."},
+    {"Accept", ARG_ACCEPT, "BOOL", 0,
+     "Stay resident, accept connections on ListenStream/ListenSequentialPacket"
+     " and start APP_TO_RUN for every connection, with connection as FD=3"},
+    {"MaxConnections", ARG_MAX_CONNECTIONS, "N", 0,
+     "With --Accept: limit of concurrently running apps, connections above"
+     " limit are closed (default: 64)"},
+    {"SpawnPool", ARG_SPAWN_POOL, "N", 0,
+     "With --Accept: number of pre-forked processes waiting for connection,"
+     " keeps fork() off the request path (default: 4)"},
+    {"Supervise", ARG_SUPERVISE, NULL, 0,
+     "Stay resident, keep listeners open and start APP_TO_RUN again whenever"
+     " it exits. Connections queue up in backlog in the meantime."},
+    {"RestartSec", ARG_RESTART_SEC, "SEC", 0,
+     "With --Supervise: delay before first restart, doubled on every crash"
+     " in a row (default: 0.1)"},
+    {"RestartMaxDelaySec", ARG_RESTART_MAX_DELAY_SEC, "SEC", 0,
+     "With --Supervise: upper limit for restart delay. App running that long"
+     " resets the delay back to RestartSec (default: 10)"},
+    {"Type", ARG_TYPE, "simple|notify", 0,
+     "notify: app reports readiness with sd_notify(\"READY=1\") on"
+     " $NOTIFY_SOCKET. On SIGHUP new app is started with same listeners,"
+     " old one gets SIGTERM once new one is ready (simple: right away)."},
+    {"TimeoutStartSec", ARG_TIMEOUT_START_SEC, "SEC", 0,
+     "With --Type=notify: time for new app to become ready on reload,"
+     " otherwise it is killed and old one keeps running (default: 90)"},
+    {"MetricsSocket", ARG_METRICS_SOCKET, "PATH", 0,
+     "Serve Prometheus text metrics of every listener (accept queue, limit,"
+     " socket memory, drops) on unix socket PATH, eg. curl --unix-socket."
+     " Resident modes serve it from supervisor, otherwise a helper process"
+     " lives as long as app does."},
+    {"MetricsFile", ARG_METRICS_FILE, "PATH", 0,
+     "Write same metrics to PATH (textfile collector) every MetricsIntervalSec"},
+    {"MetricsIntervalSec", ARG_METRICS_INTERVAL_SEC, "SEC", 0,
+     "With --MetricsFile: how often to rewrite it (default: 15)"},
+    {"LimitNOFILE", ARG_LIMIT_NOFILE, "SOFT[:HARD]", 0,
+     "RLIMIT_NOFILE, number or infinity. Applied to launcher too, as listeners"
+     " count against it."},
+    {"LimitMEMLOCK", ARG_LIMIT_MEMLOCK, "SOFT[:HARD]", 0,
+     "RLIMIT_MEMLOCK, bytes (K, M, G suffix) or infinity"},
+    {"CPUSchedulingPolicy", ARG_CPU_SCHEDULING_POLICY, "other|batch|idle|fifo|rr", 0,
+     "Scheduling policy of app"},
+    {"CPUSchedulingPriority", ARG_CPU_SCHEDULING_PRIORITY, "1..99", 0,
+     "Static priority for fifo and rr (default: 1)"},
+    {"Nice", ARG_NICE, "-20..19", 0, "Nice level of app"},
+    {"IOSchedulingClass", ARG_IO_SCHEDULING_CLASS, "realtime|best-effort|idle|none", 0,
+     "I/O scheduling class of app"},
+    {"IOSchedulingPriority", ARG_IO_SCHEDULING_PRIORITY, "0..7", 0,
+     "I/O priority within class, lower is more important (default: 4)"},
+    {"TimerSlackNSec", ARG_TIMER_SLACK_NSEC, "NSEC", 0,
+     "PR_SET_TIMERSLACK: how much later timers of app may fire, so wakeups"
+     " are coalesced"},
+    {"TransparentHugePages", ARG_TRANSPARENT_HUGE_PAGES, "default|never|madvise", 0,
+     "PR_SET_THP_DISABLE: never - no THP for app, madvise - only for"
+     " MADV_HUGEPAGE regions (6.18+)"},
+    {"OOMScoreAdjust", ARG_OOM_SCORE_ADJUST, "-1000..1000", 0,
+     "oom_score_adj of app"},
+    {"Slice", ARG_SLICE, "PATH", 0,
+     "cgroup v2 app runs in, relative to cgroup2 mount (eg. apps/web) and"
+     " created if missing. Resident modes start apps with"
+     " clone3(CLONE_INTO_CGROUP), launcher itself stays where it is."},
+    {"CPUWeight", ARG_CPU_WEIGHT, "1..10000", 0, "cpu.weight of Slice"},
+    {"CPUQuota", ARG_CPU_QUOTA, "PERCENT%", 0,
+     "cpu.max of Slice, per 100ms period. 200% is two full CPUs."},
+    {"MemoryHigh", ARG_MEMORY_HIGH, "BYTES", 0,
+     "memory.high of Slice (K, M, G, T suffix) or infinity: reclaimed and"
+     " throttled above"},
+    {"MemoryMax", ARG_MEMORY_MAX, "BYTES", 0,
+     "memory.max of Slice, OOM killed above"},
+    {"IOWeight", ARG_IO_WEIGHT, "1..10000", 0, "io.weight of Slice"},
+    {"AllowedCPUs", ARG_ALLOWED_CPUS, "LIST", 0, "cpuset.cpus of Slice, eg. 0-3,8"},
+    {"ConnectStream", ARG_CONNECT_STREAM, "ADDR[xN]", 0,
+     "Open N (default: 1) connections to unix socket path or HOST:PORT and pass"
+     " them along with listeners, named connect-ADDR. KeepAlive*, NoDelay, Mark"
+     " and Priority apply to them too. Resident modes pass same connections to"
+     " every app started."},
+    {"ConnectSourceAddress", ARG_CONNECT_SOURCE_ADDRESS, "IP", 0,
+     "Bind ConnectStream connections of same family to IP, with"
+     " IP_BIND_ADDRESS_NO_PORT so port is picked on connect"},
+    {"ConnectTimeoutSec", ARG_CONNECT_TIMEOUT_SEC, "SEC", 0,
+     "Time for all ConnectStream connections to be established (default: 5)"},
+    {"NoDelay", ARG_NO_DELAY, NULL, 0,
+     "TCP_NODELAY, accepted connections inherit it"},
+    {"FileDescriptorStoreMax", ARG_FILE_DESCRIPTOR_STORE_MAX, "N", 0,
+     "With --Supervise or --OnDemand: keep up to N descriptors app sent with"
+     " sd_pid_notify_with_fds(\"FDSTORE=1\\nFDNAME=NAME\") and pass them to"
+     " every app started later, after listeners (default: 0)"},
+    {"SharedMemory", ARG_SHARED_MEMORY, "NAME:SIZE[:hugetlb]", 0,
+     "Pass memfd of SIZE bytes (K, M, G suffix) named NAME, size sealed. In"
+     " resident modes it lives as long as listen-like does, so its content"
+     " survives app restarts."},
     {0}, /* end */
 };
 
@@ -128,13 +515,30 @@ struct keep_alive
     uint32_t probes;
 };
 
-static int keepalive_setup_fd(int fd, const struct keep_alive *ka);
+enum listen_on_kind
+{
+    /* ListenStream, ListenDatagram, ListenSequentialPacket */
+    LISTEN_ON_SOCKET = 0,
+    /* ListenXDP, AF_XDP socket */
+    LISTEN_ON_XDP,
+    /* descriptor set up together with previous listener, only passed down */
+    LISTEN_ON_AUX,
+    /* ConnectStream, connected socket */
+    LISTEN_ON_CONNECT,
+    /* ListenFIFO, named pipe */
+    LISTEN_ON_FIFO,
+    /* ListenMessageQueue, POSIX message queue */
+    LISTEN_ON_MQUEUE,
+};
 
 struct listen_on
 {
     struct listen_on *next;
 
+    enum listen_on_kind kind;
     const char *socket_listen; /* human radable name */
+    /* name in $LISTEN_FDNAMES, NULL - FileDescriptorName */
+    char *fd_name;
     struct sockaddr_storage addr;
     socklen_t addr_len;
     uint32_t mark;
@@ -155,6 +559,18 @@ struct listen_on
     /* IP_TTL */
     uint32_t ttl;
 
+    /* TCP_DEFER_ACCEPT */
+    uint32_t defer_accept;
+    /* TCP_FASTOPEN */
+    uint32_t fast_open;
+    /* TCP_FASTOPEN_KEY, file with key(s) */
+    const char *fast_open_key;
+
+    /* SO_ATTACH_FILTER, file with tcpdump -ddd output */
+    const char *socket_filter;
+    /* SO_ATTACH_BPF, pinned program */
+    const char *socket_filter_bpf;
+
     union {
         uint32_t flags;
         struct {
@@ -162,21 +578,175 @@ struct listen_on
             int reuse_port:1;
             /* SO_REUSEADDR */
             int reuse_addr:1;
+            /* SO_PREFER_BUSY_POLL */
+            int prefer_busy_poll:1;
+            /* incoming_cpu is valid, 0 is a valid CPU */
+            int incoming_cpu_set:1;
+            /* SO_RCVBUFFORCE, SO_SNDBUFFORCE */
+            int buffer_force:1;
+            /* UDP_GRO */
+            int udp_gro:1;
+            /* SO_RXQ_OVFL */
+            int rxq_overflow:1;
+            /* TCP_NODELAY */
+            int no_delay:1;
+            /* IP_FREEBIND, IPV6_FREEBIND */
+            int free_bind:1;
+            /* IP_TRANSPARENT, IPV6_TRANSPARENT */
+            int transparent:1;
+            /* SO_TIMESTAMPNS */
+            int timestamp_ns:1;
+            /* SO_ATTACH_REUSEPORT_EBPF, BPF_SK_REUSEPORT_SELECT_OR_MIGRATE */
+            int reuse_port_migrate:1;
+            /* member of ReusePortGroup, leader and clones alike */
+            int reuse_port_steered:1;
+            /* LockUnixSockets, lock_fd is valid */
+            int locked:1;
         };
     };
 
+    /* SO_TIMESTAMPING, SOF_TIMESTAMPING_* */
+    uint32_t timestamping;
+
+    /* SO_BUSY_POLL */
+    uint32_t busy_poll_usec;
+    /* SO_BUSY_POLL_BUDGET */
+    uint32_t busy_poll_budget;
+    /* SO_INCOMING_CPU */
+    uint32_t incoming_cpu;
+    /* UDP_SEGMENT */
+    uint32_t udp_segment;
+
+    /* ListenXDP: UDP destination port redirected to socket */
+    uint16_t xdp_port;
+
+    /* port range, last port to listen on, 0 - single port */
+    uint16_t port_range_last;
+
+    /* ConnectStream: number of connections, expanded into clones */
+    uint32_t connect_count;
+
+    /* number of sockets in SO_REUSEPORT group, set only on first member */
+    uint32_t reuse_port_group;
+
+    /* socket, options, bind and listen already done by io_uring batch */
+    int set_up;
+
+    /* sock_diag matches sockets by inode, set once descriptors are final */
+    ino_t ino;
+
+    /* flock'd ~socket file, passed after listeners: 3 + $LISTEN_FDS, ... */
+    int lock_fd;
+
     int fd;
     int socket_type;
     uint32_t socket_protocol;
 };
 
+/*
+    Listeners are carved out of blocks and block size doubles, so tens of
+    thousands of listeners (eg. port range) cost a handful of mallocs.
+*/
+struct listen_on_block
+{
+    struct listen_on_block *next;
+    size_t used;
+    size_t capacity;
+    struct listen_on items[];
+};
+
+static struct listen_on_block *listen_on_blocks;
+
+/* integer socket option, same for setsockopt(2) and io_uring */
+struct sockopt
+{
+    int level;
+    int name;
+    uint32_t value;
+    /* for error messages */
+    const char *what;
+};
+
+#define LISTEN_ON_SOCKOPTS_MAX 28
+
 static int listen_on_set_fd_options(const struct listen_on *lo);
-static struct listen_on *listen_on_new(struct listen_on *base);
+static int listen_on_sockopts(const struct listen_on *lo, struct sockopt opts[LISTEN_ON_SOCKOPTS_MAX]);
+static int listen_on_sockopts_only(const struct listen_on *lo);
+static struct listen_on *listen_on_new(struct listen_on *after);
 static int listen_on_size(struct listen_on *base);
+static struct listen_on *listen_on_clone(struct listen_on *lo);
+static int listen_on_reuse_port_group(struct listen_on *lo, uint32_t size);
+static int listen_on_port_range(struct listen_on *lo);
+static int listen_on_connect_count(struct listen_on *lo, const struct listen_on *base);
+static int listen_on_connect_wait(struct listen_on *base, uint32_t timeout_ms);
+static uint16_t listen_on_port(const struct listen_on *lo);
+static int listen_on_move_fd(int *fd, int expected, int high);
+static int listen_on_place_fd(int *fd, int expected);
+static int listen_on_arrange_fds(struct listen_on *base);
+static char *listen_on_fd_names(struct listen_on *base, const char *name);
+static struct listen_on *listen_on_add_aux(struct listen_on *lo, int fd, char *fd_name);
+static int listen_on_pollable(const struct listen_on *lo);
 static void listen_on_free(struct listen_on *lo);
 static const char* listen_on_family_to_text(const struct listen_on *lo);
 static const char* listen_on_type(const struct listen_on *lo);
 static const char* listen_on_proto(const struct listen_on *lo);
+static int listen_on_is_tcp(const struct listen_on *lo);
+static int listen_on_is_udp(const struct listen_on *lo);
+
+/* applied right before execv, see profile_apply */
+struct exec_profile
+{
+    /* LimitNOFILE, LimitMEMLOCK */
+    int nofile_set;
+    struct rlimit nofile;
+    int memlock_set;
+    struct rlimit memlock;
+
+    /* CPUSchedulingPolicy, -1 - inherit */
+    int sched_policy;
+    /* CPUSchedulingPriority, 0 - lowest valid for policy */
+    int sched_priority;
+
+    /* Nice */
+    int nice_set;
+    int nice;
+
+    /* IOSchedulingClass, -1 - inherit */
+    int io_class;
+    /* IOSchedulingPriority */
+    int io_priority;
+
+    /* TimerSlackNSec, 0 - inherit */
+    unsigned long timer_slack_ns;
+
+    /* TransparentHugePages, 0 - inherit */
+    int thp;
+
+    /* OOMScoreAdjust */
+    int oom_score_adjust_set;
+    int oom_score_adjust;
+
+    /* Slice, relative to cgroup2 mount, NULL - stay in launcher's cgroup */
+    const char *slice;
+    /* 0 - not set, for all of them */
+    int cpu_weight;
+    uint32_t cpu_quota_percent;
+    /* RLIM_INFINITY - max */
+    rlim_t memory_high;
+    rlim_t memory_max;
+    int io_weight;
+    const char *allowed_cpus;
+    /* opened Slice, -1 - none */
+    int cgroup_fd;
+};
+
+static int profile_apply_limits(const struct exec_profile *profile);
+static int profile_apply(const struct exec_profile *profile);
+static int profile_cgroup_setup(struct exec_profile *profile);
+static int profile_cgroup_join(const struct exec_profile *profile);
+static pid_t profile_fork(const struct exec_profile *profile);
+static int cgroup_write(int dir, const char *file, const char *value);
+static int cgroup2_mount_point(char *out, size_t size);
 
 struct arguments
 {
@@ -186,6 +756,8 @@ struct arguments
     /* NOTE(m): Wrap this into it's own struct if support for multiple
     listening sockets will be desirable */
     struct listen_on listeners;
+    /* last listener added by parser, appending is O(1) */
+    struct listen_on *listeners_tail;
 
     /* options for (non abstract) unix socket */
     uid_t user;
@@ -196,43 +768,452 @@ struct arguments
 
     /* options for listening */
     int backlog;
+    /* 0 - no SO_REUSEPORT groups */
+    uint32_t reuse_port_group;
+
+    /* $LISTEN_FDNAMES */
+    const char *fd_name;
+
+    /* ListenXDP */
+    uint32_t xdp_frame_size;
+    uint32_t xdp_frame_count;
+    uint32_t xdp_ring_size;
+    /* 0 - auto, XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE */
+    uint32_t xdp_mode;
+
+    /* stay resident and spawn app on first activity */
+    int on_demand;
+    /* 0 - never ask app to exit */
+    uint32_t idle_exit_sec;
+
+    /* Accept=yes, app per connection */
+    int accept;
+    uint32_t max_connections;
+    uint32_t spawn_pool;
+
+    /* restart app whenever it exits */
+    int supervise;
+    uint32_t restart_ms;
+    uint32_t restart_max_ms;
+
+    /* Type=notify, wait for READY=1 */
+    int notify;
+    uint32_t timeout_start_ms;
+
+    /* Prometheus text exporter */
+    const char *metrics_socket;
+    const char *metrics_file;
+    uint32_t metrics_interval_ms;
+
+    struct exec_profile profile;
+
+    /* ConnectSourceAddress, ss_family 0 - none */
+    struct sockaddr_storage connect_source;
+    /* ConnectTimeoutSec */
+    uint32_t connect_timeout_ms;
+
+    /* FileDescriptorStoreMax, 0 - no FD store */
+    uint32_t fd_store_max;
+
+    /* PipeSize, 0 - kernel default */
+    uint32_t pipe_size;
+    /* MessageQueueMaxMessages, MessageQueueMessageSize, 0 - kernel default */
+    long mq_max_messages;
+    long mq_message_size;
+
+    /* TraceStartup, NULL - off */
+    const char *trace_startup;
+
+    /* HandoffSocket, InheritFrom */
+    const char *handoff_socket;
+    const char *inherit_from;
+
+    /* Workers, 0 - single app */
+    uint32_t workers;
 };
 
 static void arguments_free(struct arguments *args);
 static struct listen_on *arguments_obtain_listen_on(struct arguments *args);
 static int arguments_create_path(const char *path, const struct arguments *arguments);
+static void arguments_exec(const struct arguments *args, char *const app_argv[]);
+
+struct child
+{
+    pid_t pid;
+    /* pidfd_open(2), readable when child exits */
+    int pidfd;
+};
+
+/* Accept=yes: pre-forked process waiting for connection, later app itself */
+struct handler
+{
+    struct child child;
+    /* socketpair to idle handler, -1 once connection was handed over */
+    int sock;
+    /* connection was handed over, counted in active */
+    int busy;
+};
+
+/* bare minimum of io_uring, no liburing needed */
+struct uring
+{
+    int fd;
+    unsigned sq_entries;
+    unsigned sqe_tail;
+    unsigned to_submit;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+static int uring_init(struct uring *r, unsigned entries);
+static struct io_uring_sqe *uring_get_sqe(struct uring *r);
+static int uring_submit(struct uring *r, unsigned wait_nr);
+static struct io_uring_cqe *uring_peek_cqe(struct uring *r);
+static void uring_cqe_seen(struct uring *r);
+static void uring_free(struct uring *r);
+
+/* not in older headers, values are ABI */
+#ifndef IORING_OP_BIND
+#define IORING_OP_BIND 56
+#endif
+#ifndef IORING_OP_LISTEN
+#define IORING_OP_LISTEN 57
+#endif
+#ifndef SOCKET_URING_OP_SETSOCKOPT
+#define SOCKET_URING_OP_SETSOCKOPT 3
+#endif
+
+#define URING_SETUP_ENTRIES 256
+
+/* one per SQE in flight during listener setup */
+struct uring_setup_op
+{
+    struct listen_on *lo;
+    uint8_t opcode;
+    const char *what;
+    /* setsockopt optval, has to live until completion */
+    uint32_t value;
+};
+
+struct uring_setup
+{
+    struct uring ring;
+    struct uring_setup_op ops[URING_SETUP_ENTRIES];
+    unsigned queued;
+    /* kernel has IORING_OP_URING_CMD, but not for sockets */
+    int no_sockopts;
+    int failed;
+};
+
+static int listen_on_setup_uring(struct listen_on *base, int backlog);
+static int uring_setup_supported(struct uring *r);
+static struct io_uring_sqe *uring_setup_sqe(struct uring_setup *us, struct listen_on *lo, uint8_t opcode, const char *what);
+static void uring_setup_flush(struct uring_setup *us);
+
+/* sorted by inode, so sock_diag dumps are matched with bsearch */
+struct metrics_ino
+{
+    ino_t ino;
+    uint32_t index;
+};
+
+struct metrics
+{
+    const struct arguments *arguments;
+    /* MetricsSocket, -1 when not used */
+    int fd;
+    /* CLOCK_MONOTONIC ms, next MetricsFile rewrite, INT64_MAX when not used */
+    int64_t next_write;
+};
+
+/* sock_diag results for single listener */
+struct metrics_sample
+{
+    int found;
+    /* listening: accept queue and its limit, else receive/send queue */
+    uint32_t rqueue;
+    uint32_t wqueue;
+    uint32_t skmem[SK_MEMINFO_VARS];
+};
+
+static int metrics_setup(struct metrics *m, const struct arguments *args);
+static int metrics_ino_cmp(const void *a, const void *b);
+static int metrics_serve(struct metrics *m);
+static int metrics_write_file(struct metrics *m);
+static void metrics_tick(struct metrics *m);
+static int metrics_spawn_helper(struct metrics *m);
+static char *metrics_render(const struct arguments *args, size_t *size);
+static int metrics_diag(int family, int protocol, const struct metrics_ino *inos, size_t inos_size, struct metrics_sample *samples);
+static void metrics_netstat(uint64_t *listen_overflows, uint64_t *listen_drops);
+static void metrics_label(FILE *out, const struct listen_on *lo, const char *kind);
+
+/* epoll_event.data.u64 = kind << 32 | fd or index */
+enum watch_kind
+{
+    WATCH_SIGNAL = 1,
+    WATCH_LISTENER,
+    WATCH_CHILD,
+    WATCH_HANDLER,
+    WATCH_URING,
+    WATCH_NOTIFY,
+    WATCH_METRICS,
+    WATCH_HANDOFF,
+};
+/* Accept=yes: out of descriptors, give handlers a moment to close some */
+#define ACCEPT_REARM_MS 100
+
+#define WATCH(kind, value) (((uint64_t)(kind) << 32) | (uint32_t)(value))
+#define WATCH_KIND(u64) ((enum watch_kind)((u64) >> 32))
+#define WATCH_VALUE(u64) ((uint32_t)(u64))
+
+/* Workers=N: one of apps sharing listeners */
+struct worker
+{
+    struct child child;
+    /* slice of launcher's affinity, CPUs of one NUMA node where possible */
+    cpu_set_t cpus;
+    /* NUMA node of those CPUs, -1 - single node system or unknown */
+    int node;
+
+    int64_t started_at;
+    int restart_pending;
+    int64_t restart_at;
+    uint32_t restart_delay;
+    /* asked to exit by SIGHUP, not a crash */
+    int reloading;
+};
+
+/* FileDescriptorStoreMax: descriptor app asked to keep with FDSTORE=1 */
+struct fd_store_entry
+{
+    int fd;
+    /* FDNAME, "stored" when not given */
+    char name[256];
+};
+
+struct supervisor
+{
+    const struct arguments *arguments;
+    char *const *app_argv;
+
+    int epoll_fd;
+    int signal_fd;
+    /* signals blocked in supervisor, restored in child */
+    sigset_t old_mask;
+
+    struct child child;
+    /* CLOCK_MONOTONIC ms, last time something knocked on listeners */
+    int64_t last_activity;
+    /* SIGTERM already sent due to idleness */
+    int idle_stop_sent;
+
+    /* CLOCK_MONOTONIC ms, when current app was started */
+    int64_t started_at;
+    /* Supervise: app will be started again at restart_at */
+    int restart_pending;
+    int64_t restart_at;
+    uint32_t restart_delay;
+
+    /* $NOTIFY_SOCKET */
+    int notify_fd;
+    /* SIGHUP: new app waiting for READY=1, old ones waiting for exit */
+    struct child pending;
+    int64_t pending_deadline;
+    struct child *draining;
+    uint32_t draining_size;
+
+    /* passed to every app started, after listeners */
+    struct fd_store_entry *fd_store;
+    uint32_t fd_store_size;
+
+    /* Accept=yes, max_connections + spawn_pool slots */
+    struct handler *handlers;
+    uint32_t handlers_size;
+    uint32_t idle;
+    uint32_t active;
+    /* multishot accept, epoll on listeners when not available */
+    struct uring ring;
+    int use_uring;
+    /* listeners whose multishot accept ended on EMFILE, armed again at accept_rearm_at */
+    int *accept_rearm;
+    uint32_t accept_rearm_size;
+    int64_t accept_rearm_at;
+
+    struct metrics metrics;
+
+    /* HandoffSocket, -1 - none */
+    int handoff_fd;
+
+    /* Workers */
+    struct worker *workers;
+    uint32_t workers_size;
+};
+
+static int supervisor_run(const struct arguments *args, char *const app_argv[]);
+static int supervisor_arm_listeners(struct supervisor *sv);
+static int supervisor_fork_app(struct supervisor *sv, struct child *child, int worker);
+static int supervisor_spawn(struct supervisor *sv);
+static int supervisor_respawn(struct supervisor *sv);
+static int supervisor_reap(struct supervisor *sv, pid_t pid);
+static int supervisor_notify_setup(struct supervisor *sv);
+static int supervisor_notify_ready(struct supervisor *sv);
+static void supervisor_fd_store_add(struct supervisor *sv, const int *fds, size_t count, const char *name);
+static void supervisor_fd_store_remove(struct supervisor *sv, const char *name);
+static int supervisor_fd_store_install(const struct supervisor *sv);
+static int supervisor_reload(struct supervisor *sv);
+static int supervisor_promote(struct supervisor *sv);
+static int supervisor_stop(struct supervisor *sv, int sig);
+static int supervisor_timeout(const struct supervisor *sv);
+static int supervisor_schedule_restart(struct supervisor *sv);
+static int supervisor_watch(struct supervisor *sv, int fd, uint32_t events, enum watch_kind kind, uint32_t value);
+static int supervisor_accept_setup(struct supervisor *sv);
+static int supervisor_accept_ready(struct supervisor *sv, int fd);
+static int supervisor_uring_arm(struct supervisor *sv, int fd);
+static int supervisor_uring_ready(struct supervisor *sv);
+static int supervisor_dispatch(struct supervisor *sv, int conn);
+static int supervisor_fill_pool(struct supervisor *sv);
+static int supervisor_spawn_handler(struct supervisor *sv, struct handler *h);
+static int supervisor_reap_handler(struct supervisor *sv, struct handler *h);
+static void handler_wait_for_connection(const struct arguments *args, char *const app_argv[], int sock);
+static int supervisor_workers_setup(struct supervisor *sv);
+static int supervisor_spawn_worker(struct supervisor *sv, uint32_t index);
+static int supervisor_reap_worker(struct supervisor *sv, struct worker *w, int status);
+static int supervisor_worker_restart(struct supervisor *sv, struct worker *w);
+static int worker_cpu_node(int cpu);
+static int worker_cpu_cmp(const void *a, const void *b);
+static int worker_pin(const struct worker *w, uint32_t index);
 
 /* parse methods */
 static int parse_ushort(const char *v, unsigned short *out);
 static int parse_ulong(const char *v, const int base, unsigned long *out);
 static int parse_int(const char *v, int *out);
 static int parse_uint32(const char *v, uint32_t *out);
+static int parse_bool(const char *v, int *out);
+static int parse_msec(const char *v, uint32_t *out);
 static int parse_user(const char *v, uid_t *user);
 static int parse_group(const char *v, gid_t *group);
 static int parse_mode(const char *v, mode_t *mode);
 static int parse_addr(const char *v, struct listen_on *lo);
+static int parse_connect(const char *v, struct listen_on *lo);
+static int parse_ip(const char *v, struct sockaddr_storage *out);
+static int parse_shared_memory(const char *v, struct listen_on *lo);
+static int parse_port_range(const char *v, unsigned short *first, uint16_t *last);
+static int parse_group_size(const char *v, uint32_t *out);
+static int parse_xdp(const char *v, struct listen_on *lo);
+static int parse_power_of_2(const char *v, uint32_t min, uint32_t max, uint32_t *out);
+static int parse_int_range(const char *v, int min, int max, int *out);
+static int parse_name_value(const char *v, const struct name_value *items, const char *what, int *out);
+static int parse_rlimit(const char *v, struct rlimit *out);
+static int parse_timestamping(const char *v, struct listen_on *lo);
+
+/* xdp */
+static int sys_bpf(int cmd, union bpf_attr *attr, unsigned int size);
+static int xdp_umem_create(size_t size, void **area);
+static int xdp_prog_load(int xsk_map_fd, uint16_t port);
+static int listen_on_setup_xdp(struct listen_on *lo, const struct arguments *args);
+
+/* ConnectStream, needs arguments for source address */
+static int listen_on_connect(struct listen_on *lo, const struct arguments *args);
+
+/* HandoffSocket, InheritFrom */
+static int handoff_listen(const struct arguments *args);
+static int handoff_serve(const struct arguments *args, int server_fd);
+static int handoff_send(int conn, const struct listen_on *lo);
+static int handoff_inherit(struct listen_on *base, const char *path);
+static int handoff_match(const struct listen_on *lo, int fd);
+
+/* ListenFIFO, ListenMessageQueue */
+static int listen_on_setup_fifo(struct listen_on *lo, const struct arguments *args);
+static int listen_on_setup_mqueue(struct listen_on *lo, const struct arguments *args);
+static int listen_on_set_owner(int fd, const struct arguments *args);
+
+/* TraceStartup: completed phases, written as JSON right before exec */
+struct trace_event
+{
+    const char *phase;
+    /* listener (socket_listen) or option, "" for whole launcher phases */
+    const char *detail;
+    uint16_t port;
+    uint64_t start_ns;
+    uint64_t end_ns;
+};
+
+struct startup_trace
+{
+    /* nothing is known before options are parsed, so record until then */
+    int enabled;
+    struct trace_event *events;
+    size_t size;
+    size_t capacity;
+};
+
+static struct startup_trace startup_trace = {.enabled = true};
+
+static uint64_t trace_now_ns(void);
+static struct trace_event trace_begin(const char *phase, const char *detail, uint16_t port);
+static void trace_end(struct trace_event *span);
+static int trace_event_cmp(const void *a, const void *b);
+static int trace_write(const char *path);
 
 /* misc */
 static int set_tos(int fd, int tos);
 static int set_dscp(int fd, int dscp);
 static int set_ttl(int fd, int ttl);
-static int lock_unix_socket(const struct sockaddr_un *unix_addr);
+static int lock_unix_socket(struct listen_on *lo);
 static int open_or_mkdir(int fd, const char *name, mode_t mode);
 static int set_sol(int fd, int arg, uint32_t opt);
-static int set_tcpopt(int fd, int arg, int val);
+static int set_sol_force(int fd, int arg, int force_arg, uint32_t opt);
+static int set_reuseport_cpu_steering(int fd, uint32_t group_size);
+static int set_fast_open_key(int fd, const char *path);
+static int set_socket_filter(int fd, const char *path);
+static int set_socket_filter_bpf(int fd, const char *pinned);
+static int64_t monotonic_ms(void);
+
+/* ReusePortMigrate, program shared by every listener, -1 - sysctl or none */
+static int reuseport_migrate_prog = -1;
+static int reuseport_migrate_setup(struct listen_on *base, int steered);
+static int reuseport_migrate_prog_load(void);
 
 /* listen_on impl */
 
-static struct listen_on *listen_on_new(struct listen_on *base)
+static struct listen_on *listen_on_new(struct listen_on *after)
 {
-    struct listen_on *lo = base;
-    while (lo->next)
+    struct listen_on_block *block = listen_on_blocks;
+    if (block == NULL || block->used == block->capacity)
     {
-        lo = lo->next;
+        const size_t capacity = block ? block->capacity * 2 : 16;
+        block = malloc(sizeof(*block) + capacity * sizeof(block->items[0]));
+        if (block == NULL)
+        {
+            perror("malloc");
+            exit(1);
+        }
+        block->next = listen_on_blocks;
+        block->used = 0;
+        block->capacity = capacity;
+        listen_on_blocks = block;
     }
-    lo->next = malloc(sizeof(*lo->next));
-    memset(lo->next, 0, sizeof(*lo->next));
-    return lo->next;
+
+    struct listen_on *lo = &block->items[block->used++];
+    memset(lo, 0, sizeof(*lo));
+    lo->next = after->next;
+    after->next = lo;
+    return lo;
 }
 
 static int listen_on_size(struct listen_on *base)
@@ -256,490 +1237,1795 @@ static void listen_on_free(struct listen_on *lo)
     while (current)
     {
         next = current->next;
-        free(current);
+        free(current->fd_name);
         current = next;
     }
-}
 
-static const char* listen_on_family_to_text(const struct listen_on *lo)
-{
-    // unix, tcp, seq, udp
-    switch (lo->addr.ss_family)
+    while (listen_on_blocks)
     {
-    case AF_UNIX:
-        return "unix";
-    case AF_PACKET:
-        return "packet";
-    case AF_INET:
-        return "inet";
-    default:
-        return "unknown family";
+        struct listen_on_block *block = listen_on_blocks;
+        listen_on_blocks = block->next;
+        free(block);
     }
 }
 
-static const char* listen_on_type(const struct listen_on *lo)
+static struct listen_on *listen_on_add_aux(struct listen_on *lo, int fd, char *fd_name)
 {
-    switch(lo->socket_type)
+    /* memfd, BPF link: created O_CLOEXEC, fd already in its slot is not dup2'd */
+    if (fcntl(fd, F_SETFD, 0))
     {
-        case SOCK_DGRAM:
-            return "dgram";
-        case SOCK_STREAM:
-            return "stream";
-        case SOCK_SEQPACKET:
-            return "seq";
-        default:
-            return "unknown type";
+        perror("F_SETFD");
     }
+
+    struct listen_on *aux = listen_on_new(lo);
+    aux->kind = LISTEN_ON_AUX;
+    aux->socket_listen = lo->socket_listen;
+    aux->fd = fd;
+    aux->fd_name = fd_name;
+    return aux;
 }
 
-static const char* listen_on_proto(const struct listen_on *lo)
+static int listen_on_pollable(const struct listen_on *lo)
 {
-    if (lo->addr.ss_family == AF_UNIX) {
-        /* no proto for unix */
-        return "no proto";
-    }
-
-    switch(lo->socket_protocol) {
-        case IPPROTO_UDP:
-            return "udp";
-        case IPPROTO_TCP:
-            return "tcp";
-        default:
-            return "unknown proto";
-    }
+    /* memfd and friends: nothing will ever arrive there, connections belong to app */
+    return lo->kind != LISTEN_ON_AUX && lo->kind != LISTEN_ON_CONNECT;
 }
 
-static int listen_on_set_fd_options(const struct listen_on *lo)
+static struct listen_on *listen_on_clone(struct listen_on *lo)
 {
-    int fd = lo->fd;
-
-    if (lo->mark && set_sol(fd, SO_MARK, lo->mark))
-    {
-        perror("SO_MARK");
-        fprintf(stderr, "Unable to set mark %u to %s\n", lo->mark, lo->socket_listen);
-        return 1;
-    }
-
-    if (lo->priority && set_sol(fd, SO_PRIORITY, lo->priority))
-    {
-        perror("priority");
-        return 1;
-    }
+    struct listen_on *clone = listen_on_new(lo);
+    struct listen_on *next = clone->next;
+    memcpy(clone, lo, sizeof(*clone));
+    clone->next = next;
+    clone->reuse_port_group = 0;
+    clone->port_range_last = 0;
+    clone->connect_count = 0;
+    clone->fd_name = lo->fd_name ? strdup(lo->fd_name) : NULL;
+    return clone;
+}
 
-    if (lo->reuse_port && set_sol(fd, SO_REUSEPORT, 1))
+static uint16_t listen_on_port(const struct listen_on *lo)
+{
+    switch (lo->addr.ss_family)
     {
-        perror("reuse port");
-        return 1;
+    case AF_INET:
+        return ntohs(((const struct sockaddr_in *)&lo->addr)->sin_port);
+    case AF_INET6:
+        return ntohs(((const struct sockaddr_in6 *)&lo->addr)->sin6_port);
+    default:
+        return 0;
     }
+}
 
-    if (lo->reuse_addr && set_sol(fd, SO_REUSEADDR, 1))
+static int listen_on_port_range(struct listen_on *lo)
+{
+    const uint16_t last = lo->port_range_last;
+    if (last == 0)
     {
-        perror("reuse addr");
-        return 1;
+        return 0;
     }
 
-    if (keepalive_setup_fd(fd, &lo->keep_alive))
-    {
-        perror("keepalive");
-        return 1;
-    }
+    uint16_t *port = lo->addr.ss_family == AF_INET6
+        ? &((struct sockaddr_in6 *)&lo->addr)->sin6_port
+        : &((struct sockaddr_in *)&lo->addr)->sin_port;
 
-    if (lo->recv_buffer && set_sol(fd, SO_RCVBUF, lo->recv_buffer))
+    /* clones go right after lo, walk forward so ports stay ascending */
+    struct listen_on *prev = lo;
+    for (uint32_t p = ntohs(*port) + 1; p <= last; ++p)
     {
-        perror("rcv");
-        return 1;
+        prev = listen_on_clone(prev);
+        port = prev->addr.ss_family == AF_INET6
+            ? &((struct sockaddr_in6 *)&prev->addr)->sin6_port
+            : &((struct sockaddr_in *)&prev->addr)->sin_port;
+        *port = htons((uint16_t)p);
     }
+    lo->port_range_last = 0;
+    return 0;
+}
 
-    if (lo->send_buffer && set_sol(fd, SO_SNDBUF, lo->send_buffer))
+static int listen_on_connect_count(struct listen_on *lo, const struct listen_on *base)
+{
+    if (lo->kind != LISTEN_ON_CONNECT)
     {
-        perror("snd");
-        return 1;
+        return 0;
     }
 
-    if (lo->ttl && set_ttl(fd, lo->ttl))
+    /* options land on first listener, connections take what makes sense for them */
+    if (lo != base && lo->addr.ss_family != AF_UNIX)
     {
-        perror("ttl");
-        return 1;
+        lo->keep_alive = base->keep_alive;
+        lo->no_delay = base->no_delay;
     }
-
-    if (lo->tos && set_tos(fd, lo->tos))
+    if (lo != base)
     {
-        perror("tos");
-        return 1;
+        lo->mark = base->mark;
+        lo->priority = base->priority;
     }
 
-    /* ToS is deprecated, so ensure dscp is set after it  in case where
-       both values are present
-    */
-    if (lo->dscp && set_dscp(fd, lo->dscp))
+    for (uint32_t i = 1; i < lo->connect_count; ++i)
     {
-        perror("DSCP");
-        return 1;
+        listen_on_clone(lo);
     }
-
+    lo->connect_count = 0;
     return 0;
 }
 
-/* arguments impl */
-
-static struct listen_on *arguments_obtain_listen_on(struct arguments *args)
+static int listen_on_connect(struct listen_on *lo, const struct arguments *args)
 {
-    if (args->listeners.addr.ss_family == 0)
+    /* non-blocking, so all connections are in flight at once */
+    lo->fd = socket(lo->addr.ss_family, lo->socket_type | SOCK_NONBLOCK, lo->socket_protocol);
+    if (lo->fd < 0)
     {
-        return &args->listeners;
+        perror("socket");
+        return 1;
     }
-    return listen_on_new(&args->listeners);
-}
 
-static void arguments_free(struct arguments *args)
-{
-    /* use next, base is not malloced */
-    listen_on_free(args->listeners.next);
-}
-
-static int arguments_create_path(const char *path, const struct arguments *arguments)
-{
-    /* This is 'hack' as path should always be sun_path */
-    char path_dup[sizeof(((struct sockaddr_un *)NULL)->sun_path)];
-    // NOLINTNEXTLINE: insecure, srecure
-    memcpy(path_dup, path, sizeof(path_dup));
-
-    char *dirs = dirname(path_dup);
-    char *tok_state = NULL;
-    // Root '/' is expected to be created by someone else
-    int dir_fd = open_or_mkdir(-1, "/", 0);
-    if (dir_fd < 0)
+    if (listen_on_set_fd_options(lo))
     {
-        perror("root open failed");
         return 1;
     }
 
-    char *tok = strtok_r(dirs, "/", &tok_state);
-    while (tok != NULL)
+    if (args->connect_source.ss_family && args->connect_source.ss_family == lo->addr.ss_family)
     {
-        errno = 0;
-        int new_fd = open_or_mkdir(dir_fd, tok, arguments->directory_mode);
-        if (new_fd < 0)
+        /* without it bind reserves port for good, exhausting range with many connections */
+        const int one = 1;
+        if (setsockopt(lo->fd, SOL_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one)))
         {
-            perror("dirdasz");
+            perror("IP_BIND_ADDRESS_NO_PORT");
             return 1;
         }
-        close(dir_fd);
-        dir_fd = new_fd;
 
-        /* advance to next token */
-        tok = strtok_r(NULL, "/", &tok_state);
+        const socklen_t len = lo->addr.ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+        if (bind(lo->fd, (const struct sockaddr *)&args->connect_source, len))
+        {
+            perror("ConnectSourceAddress");
+            return 1;
+        }
+    }
+
+    if (connect(lo->fd, (const struct sockaddr *)&lo->addr, lo->addr_len) && errno != EINPROGRESS)
+    {
+        fprintf(stderr, "connect %s: %s\n", lo->socket_listen, strerror(errno));
+        return 1;
     }
-    close(dir_fd);
     return 0;
 }
 
-/* keepalive impl */
-
-int keepalive_setup_fd(int fd, const struct keep_alive *keep_alive)
+static int listen_on_connect_wait(struct listen_on *base, uint32_t timeout_ms)
 {
-    if (!keep_alive->enable)
+    nfds_t count = 0;
+    for (const struct listen_on *lo = base; lo != NULL; lo = lo->next)
     {
-        return 0;
+        count += lo->kind == LISTEN_ON_CONNECT;
     }
-
-    if (set_sol(fd, SO_KEEPALIVE, keep_alive->enable))
+    if (count == 0)
     {
-        perror("keepalive");
-        exit(1);
+        return 0;
     }
 
-    if (keep_alive->time && set_tcpopt(fd, TCP_KEEPIDLE, keep_alive->time))
+    struct pollfd *fds = calloc(count, sizeof(*fds));
+    if (fds == NULL)
     {
-        perror("keepidle");
-        exit(1);
+        perror("calloc");
+        return 1;
     }
 
-    if (keep_alive->probes && set_tcpopt(fd, TCP_KEEPCNT, keep_alive->probes))
+    nfds_t i = 0;
+    for (const struct listen_on *lo = base; lo != NULL; lo = lo->next)
     {
-        perror("keepcnt");
-        exit(1);
+        if (lo->kind == LISTEN_ON_CONNECT)
+        {
+            fds[i++] = (struct pollfd){.fd = lo->fd, .events = POLLOUT};
+        }
     }
 
-    if (keep_alive->interval && set_tcpopt(fd, TCP_KEEPINTVL, keep_alive->interval))
+    /* poll only the ones still in flight, done ones get negative fd */
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    nfds_t pending = count;
+    int ret = 0;
+    while (pending)
     {
-        perror("keepintv");
-        exit(1);
-    }
-
-    return 0;
-}
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        const int64_t elapsed_ms = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (elapsed_ms >= timeout_ms)
+        {
+            break;
+        }
 
-/* parsers impl */
+        const int ready = poll(fds, count, (int)(timeout_ms - elapsed_ms));
+        if (ready < 0 && errno != EINTR)
+        {
+            perror("poll");
+            ret = 1;
+            goto out;
+        }
 
-static int parse_ulong(const char *v, const int base, unsigned long *out)
-{
-    char *end = NULL;
-    *out = strtoul(v, &end, base);
-    if (errno != 0)
-    {
-        return errno;
+        for (i = 0; ready > 0 && i < count; ++i)
+        {
+            if (fds[i].fd >= 0 && fds[i].revents)
+            {
+                fds[i].fd = -fds[i].fd - 1;
+                --pending;
+            }
+        }
     }
 
-    /* check if whole string was parsed */
-    if (end == NULL || strlen(end) > 0)
+    i = 0;
+    for (const struct listen_on *lo = base; lo != NULL; lo = lo->next)
     {
-        return EINVAL;
+        if (lo->kind != LISTEN_ON_CONNECT)
+        {
+            continue;
+        }
+
+        int error = 0;
+        socklen_t error_len = sizeof(error);
+        if (fds[i++].fd >= 0)
+        {
+            error = ETIMEDOUT;
+        }
+        else if (getsockopt(lo->fd, SOL_SOCKET, SO_ERROR, &error, &error_len))
+        {
+            error = errno;
+        }
+
+        if (error)
+        {
+            fprintf(stderr, "connect %s: %s\n", lo->socket_listen, strerror(error));
+            ret = 1;
+            continue;
+        }
+
+        /* app gets it the way accept would return it, blocking */
+        const int flags = fcntl(lo->fd, F_GETFL);
+        if (flags < 0 || fcntl(lo->fd, F_SETFL, flags & ~O_NONBLOCK))
+        {
+            perror("fcntl");
+            ret = 1;
+        }
     }
 
-    return 0;
+out:
+    free(fds);
+    return ret;
 }
 
-static int parse_int(const char *v, int *out)
+static int listen_on_setup_fifo(struct listen_on *lo, const struct arguments *args)
 {
-    unsigned long parsed = 0;
-    if (parse_ulong(v, 10, &parsed))
+    if (arguments_create_path(lo->socket_listen, args))
     {
-        return EINVAL;
+        return 1;
     }
-    *out = (int)parsed;
-    return 0;
-}
 
-static int parse_uint32(const char *v, uint32_t *out)
-{
-    unsigned long parsed = 0;
-    if (parse_ulong(v, 10, &parsed))
+    /* umask would cut SocketMode, so chmod once it is there */
+    int created = mkfifo(lo->socket_listen, args->socket_mode) == 0;
+    if (!created && errno != EEXIST)
     {
-        return EINVAL;
+        perror("mkfifo");
+        return 1;
     }
 
-    if (parsed < 0)
+    /* read-write: never sees EOF when last writer goes away, open does not block */
+    lo->fd = open(lo->socket_listen, O_RDWR | O_NONBLOCK | O_NOCTTY | O_NOFOLLOW);
+    if (lo->fd < 0)
     {
-        return EINVAL;
+        perror(lo->socket_listen);
+        return 1;
     }
 
-    if (parsed > 0xFFFFFFFF)
+    struct stat st;
+    if (fstat(lo->fd, &st) || !S_ISFIFO(st.st_mode))
     {
-        return EINVAL;
+        fprintf(stderr, "Not a FIFO: %s\n", lo->socket_listen);
+        return 1;
     }
 
-    *out = (uint32_t)parsed;
-
-    return 0;
-}
-#if 0
-static int parse_bool(const char *v, int *out)
-{
-    size_t len = strlen(v);
-    printf("%ld %s\n", len, v);
-    if (len == 0)
+    if (created && (fchmod(lo->fd, args->socket_mode) || listen_on_set_owner(lo->fd, args)))
     {
-        return EINVAL;
+        return 1;
     }
-    // YES, this will pass yeti, and turban as true
-    if (*v == '1' || tolower(*v) == 't' || tolower(*v) == 'y')
+
+    if (args->pipe_size && fcntl(lo->fd, F_SETPIPE_SZ, (int)args->pipe_size) < 0)
     {
-        *out = 1;
-        return 0;
+        perror("F_SETPIPE_SZ");
+        fprintf(stderr, "Unable to set pipe size %u on %s\n", args->pipe_size, lo->socket_listen);
+        return 1;
     }
-    *out = 0;
     return 0;
 }
-#endif
 
-static int parse_user(const char *v, uid_t *user)
+static int listen_on_setup_mqueue(struct listen_on *lo, const struct arguments *args)
 {
-    unsigned long parsed = 0;
-
-    fprintf(stderr, "Try parse user: %s\n", v);
+    struct mq_attr attr = {
+        .mq_maxmsg = args->mq_max_messages,
+        .mq_msgsize = args->mq_message_size,
+    };
 
-    // this might be 'human readable' or number
-    struct passwd *result = getpwnam(v);
-    if (result != NULL)
+    /* both or neither, kernel defaults otherwise */
+    const int with_attr = attr.mq_maxmsg || attr.mq_msgsize;
+    if (with_attr && (attr.mq_maxmsg == 0 || attr.mq_msgsize == 0))
     {
-        *user = result->pw_uid;
-        fprintf(stderr, "found user %d\n", *user);
-        return 0;
+        fprintf(stderr, "MessageQueueMaxMessages and MessageQueueMessageSize go together\n");
+        return 1;
     }
 
-    if (parse_ulong(v, 10, &parsed))
+    int created = true;
+    lo->fd = mq_open(lo->socket_listen, O_RDWR | O_NONBLOCK | O_CREAT | O_EXCL, args->socket_mode, with_attr ? &attr : NULL);
+    if (lo->fd < 0 && errno == EEXIST)
     {
-        goto err;
+        created = false;
+        lo->fd = mq_open(lo->socket_listen, O_RDWR | O_NONBLOCK);
+    }
+    if (lo->fd < 0)
+    {
+        perror("mq_open");
+        fprintf(stderr, "Unable to open message queue %s\n", lo->socket_listen);
+        return 1;
     }
 
-    *user = parsed;
-    return 0;
-
-err:
-    fprintf(stderr, "not known user: %s\n", v);
-    return EINVAL;
-}
-
-static int parse_group(const char *v, gid_t *group)
-{
-    unsigned long parsed = 0;
-
-    if (parse_ulong(v, 10, &parsed))
+    /* glibc always adds O_CLOEXEC, and fd already in its slot is not dup2'd */
+    if (fcntl(lo->fd, F_SETFD, 0))
     {
-        goto err;
+        perror("F_SETFD");
+        return 1;
     }
 
+    /* mqd_t is a descriptor on Linux, same as for FIFO */
+    if (created && (fchmod(lo->fd, args->socket_mode) || listen_on_set_owner(lo->fd, args)))
+    {
+        return 1;
+    }
     return 0;
-err:
-    return EINVAL;
 }
 
-static int parse_mode(const char *v, mode_t *mode)
+static int listen_on_set_owner(int fd, const struct arguments *args)
 {
-    const mode_t MAX_MODE = S_IRWXU | S_IRWXG | S_IRWXO;
-    unsigned long parsed = 0;
-    if (parse_ulong(v, 8, &parsed))
+    if (args->user == getuid() && args->group == getgid())
     {
-        goto err;
+        return 0;
     }
 
-    if (parsed > MAX_MODE)
+    if (fchown(fd, args->user, args->group))
     {
-        goto err;
+        perror("fchown");
+        return 1;
     }
-
-    *mode = (mode_t)parsed;
     return 0;
-
-err:
-    fprintf(stderr, "value (%s) not valid mode\n", v);
-    return EINVAL;
 }
 
-static int parse_ushort(const char *v, unsigned short *out)
+static int listen_on_reuse_port_group(struct listen_on *lo, uint32_t size)
 {
-    unsigned long parsed = 0;
-    if (parse_ulong(v, 10, &parsed))
+    /* SO_REUSEPORT means nothing for unix sockets, and seq is not inet */
+    if (lo->kind != LISTEN_ON_SOCKET || (lo->addr.ss_family != AF_INET && lo->addr.ss_family != AF_INET6))
     {
-        return EINVAL;
+        return 0;
     }
 
-    if (parsed > 0xFFFF)
+    if (lo->socket_type != SOCK_STREAM && lo->socket_type != SOCK_DGRAM)
     {
-        return EINVAL;
+        return 0;
     }
 
-    *out = (unsigned short)parsed;
+    lo->reuse_port = true;
+    lo->reuse_port_steered = true;
+    lo->reuse_port_group = size;
+
+    /* clones are inserted right after lo, so group joins in list order */
+    for (uint32_t i = 1; i < size; ++i)
+    {
+        if (listen_on_clone(lo) == NULL)
+        {
+            return 1;
+        }
+    }
     return 0;
 }
 
-static int parse_addr(const char *v, struct listen_on *lo)
+static int listen_on_move_fd(int *fd, int expected, int high)
 {
-    unsigned short port = 0;
-
-    if (parse_ushort(v, &port) == 0)
+    if (*fd == expected)
     {
-        // Good, only port listen on any address
-        struct sockaddr_in *in = (struct sockaddr_in *)&lo->addr;
-        lo->addr_len = sizeof(struct sockaddr_in);
-
-        in->sin_port = htons(port);
-        in->sin_family = AF_INET;
-        in->sin_addr.s_addr = htonl(INADDR_ANY);
-
-        goto ok;
+        return 0;
     }
 
-    size_t v_len = strlen(v);
-    if (v_len < 2)
+    int tmp = fcntl(*fd, F_DUPFD_CLOEXEC, high);
+    if (tmp < 0)
     {
-        return EINVAL;
+        perror("F_DUPFD");
+        return 1;
     }
+    close(*fd);
+    *fd = tmp;
+    return 0;
+}
 
-    // try parsing as unix socket
-    lo->addr_len = offsetof(struct sockaddr_un, sun_path) + v_len + 1;
-    // lo->socket_domain = AF_UNIX;
-    struct sockaddr_un *unix_addr = (struct sockaddr_un *)&lo->addr;
-    unix_addr->sun_family = AF_UNIX;
-
-    if (v[0] == '/')
-    {
-        strncpy(unix_addr->sun_path, v, sizeof(unix_addr->sun_path) - 1);
-        goto ok;
-    }
-    else if (v[1] == '@')
+static int listen_on_place_fd(int *fd, int expected)
+{
+    if (*fd == expected)
     {
-        lo->addr_len -= 1;
-        strncpy(unix_addr->sun_path + 1, v + 1, sizeof(unix_addr->sun_path) - 2);
-        goto ok;
+        return 0;
     }
 
-    struct addrinfo hints = {
-        .ai_family = AF_UNSPEC,
-        .ai_socktype = lo->socket_type,
-        .ai_flags = AI_NUMERICHOST | AI_NUMERICSERV,
-    };
-    struct addrinfo *serverinfo = NULL;
-    struct addrinfo *p = NULL;
-
-    /* BUG(m): This will pearshape on IPv6 */
-    char *p_semicolon = strchr(v, ':');
-    if (p_semicolon == NULL)
+    /* dup2 clears O_CLOEXEC on new descriptor */
+    if (dup2(*fd, expected) < 0)
     {
-        fprintf(stderr, "missing port in endpoint\n");
-        goto err;
+        perror("dup2");
+        return 1;
     }
+    close(*fd);
+    *fd = expected;
+    return 0;
+}
 
-    char v_dup[INET6_ADDRSTRLEN] = {0};
-    strncpy(v_dup, v, p_semicolon - v);
+static int listen_on_arrange_fds(struct listen_on *base)
+{
+    /*
+        sd_listen_fds expects descriptors to be 3, 4, ... in order, but
+        sockets might be created out of order (eg. SO_REUSEPORT group).
+        First move misplaced ones out of the way, then put back in place.
+        Sockets created in list order are already there, so big port
+        ranges do not need twice as many descriptors.
+        Lock files are opened between sockets, they go right after them.
+    */
+    const int size = listen_on_size(base);
+    const int first = 3;
 
-    if (getaddrinfo(v_dup, p_semicolon + 1, &hints, &serverinfo))
+    int locks = 0;
+    for (struct listen_on *lo = base; lo != NULL; lo = lo->next)
     {
-        if (errno)
+        if (lo->locked)
         {
-            perror("getaddrinfo");
+            ++locks;
         }
-        else
+    }
+    const int high = first + size + locks;
+
+    int expected = first;
+    int lock_expected = first + size;
+    for (struct listen_on *lo = base; lo != NULL; lo = lo->next, ++expected)
+    {
+        if (listen_on_move_fd(&lo->fd, expected, high)
+            || (lo->locked && listen_on_move_fd(&lo->lock_fd, lock_expected++, high)))
         {
-            fprintf(stderr, "Unable to resolve address: %s\n", v);
+            return 1;
         }
-        goto err;
     }
 
-    // Get first and call it a day:
-    lo->addr_len = serverinfo->ai_addrlen;
-    memcpy(&lo->addr, serverinfo->ai_addr, serverinfo->ai_addrlen);
-
-    if (serverinfo->ai_family != lo->addr.ss_family)
+    expected = first;
+    lock_expected = first + size;
+    for (struct listen_on *lo = base; lo != NULL; lo = lo->next, ++expected)
     {
-        fprintf(stderr, "Family missmatch\n");
-        exit(1);
+        if (listen_on_place_fd(&lo->fd, expected)
+            || (lo->locked && listen_on_place_fd(&lo->lock_fd, lock_expected++)))
+        {
+            return 1;
+        }
     }
+    return 0;
+}
 
-    if (serverinfo->ai_socktype != lo->socket_type)
+static char *listen_on_fd_names(struct listen_on *base, const char *name)
+{
+    size_t total = 0;
+    for (struct listen_on *lo = base; lo != NULL; lo = lo->next)
     {
-        fprintf(stderr, "SOCKTYPE missmatch\n");
-        exit(1);
+        total += strlen(lo->fd_name ? lo->fd_name : name) + 1;
     }
 
-    if (lo->socket_protocol == 0)
+    /* name + ':' for every fd, last ':' becomes '\0' */
+    char *names = malloc(total);
+    char *p = names;
+    for (struct listen_on *lo = base; lo != NULL; lo = lo->next)
     {
-        lo->socket_protocol = serverinfo->ai_protocol;
+        const char *fd_name = lo->fd_name ? lo->fd_name : name;
+        const size_t name_len = strlen(fd_name);
+        memcpy(p, fd_name, name_len);
+        p += name_len;
+        *p++ = ':';
     }
+    *(p - 1) = '\0';
+    return names;
+}
 
-    freeaddrinfo(serverinfo);
-
-ok:
-    lo->socket_listen = v;
-    lo->fd = socket(lo->addr.ss_family, lo->socket_type, lo->socket_protocol);
-    if (lo->fd < 0)
+static const char* listen_on_family_to_text(const struct listen_on *lo)
+{
+    // unix, tcp, seq, udp
+    switch (lo->addr.ss_family)
     {
-        perror("socket");
-        return errno;
+    case AF_UNIX:
+        return "unix";
+    case AF_PACKET:
+        return "packet";
+    case AF_INET:
+        return "inet";
+    case AF_XDP:
+        return "xdp";
+    default:
+        return "unknown family";
     }
-    return 0;
-
-err:
-    return EINVAL;
 }
 
-static error_t parser(int key, char arg[], struct argp_state *state)
+static const char* listen_on_type(const struct listen_on *lo)
 {
-    struct arguments *arguments = state->input;
-    struct listen_on *lo = &arguments->listeners;
-
-    switch (key)
+    switch(lo->socket_type)
+    {
+        case SOCK_DGRAM:
+            return "dgram";
+        case SOCK_STREAM:
+            return "stream";
+        case SOCK_SEQPACKET:
+            return "seq";
+        case SOCK_RAW:
+            return "raw";
+        default:
+            return "unknown type";
+    }
+}
+
+static const char* listen_on_proto(const struct listen_on *lo)
+{
+    if (lo->addr.ss_family == AF_UNIX || lo->addr.ss_family == AF_XDP) {
+        /* no proto for unix */
+        return "no proto";
+    }
+
+    switch(lo->socket_protocol) {
+        case IPPROTO_UDP:
+            return "udp";
+        case IPPROTO_TCP:
+            return "tcp";
+        default:
+            return "unknown proto";
+    }
+}
+
+static int listen_on_is_tcp(const struct listen_on *lo)
+{
+    /* port only address leaves socket_protocol 0, kernel picks by type */
+    return (lo->addr.ss_family == AF_INET || lo->addr.ss_family == AF_INET6)
+        && lo->socket_type == SOCK_STREAM
+        && (lo->socket_protocol == 0 || lo->socket_protocol == IPPROTO_TCP);
+}
+
+static int listen_on_is_udp(const struct listen_on *lo)
+{
+    return (lo->addr.ss_family == AF_INET || lo->addr.ss_family == AF_INET6)
+        && lo->socket_type == SOCK_DGRAM
+        && (lo->socket_protocol == 0 || lo->socket_protocol == IPPROTO_UDP);
+}
+
+static int listen_on_sockopts(const struct listen_on *lo, struct sockopt opts[LISTEN_ON_SOCKOPTS_MAX])
+{
+    int count = 0;
+#define LISTEN_ON_SOCKOPT(cond, lvl, opt, val, text) \
+    if (cond) \
+    { \
+        opts[count++] = (struct sockopt){.level = (lvl), .name = (opt), .value = (val), .what = (text)}; \
+    }
+
+    LISTEN_ON_SOCKOPT(lo->mark, SOL_SOCKET, SO_MARK, lo->mark, "SO_MARK");
+    LISTEN_ON_SOCKOPT(lo->priority, SOL_SOCKET, SO_PRIORITY, lo->priority, "priority");
+    LISTEN_ON_SOCKOPT(lo->reuse_port, SOL_SOCKET, SO_REUSEPORT, 1, "reuse port");
+    LISTEN_ON_SOCKOPT(lo->reuse_addr, SOL_SOCKET, SO_REUSEADDR, 1, "reuse addr");
+
+    /* before bind, that is where address is checked */
+    const int ipv6 = lo->addr.ss_family == AF_INET6;
+    if (ipv6 || lo->addr.ss_family == AF_INET)
+    {
+        LISTEN_ON_SOCKOPT(lo->free_bind, ipv6 ? SOL_IPV6 : SOL_IP, ipv6 ? IPV6_FREEBIND : IP_FREEBIND, 1, "FreeBind");
+        LISTEN_ON_SOCKOPT(lo->transparent, ipv6 ? SOL_IPV6 : SOL_IP, ipv6 ? IPV6_TRANSPARENT : IP_TRANSPARENT, 1, "Transparent");
+    }
+
+    const struct keep_alive *keep_alive = &lo->keep_alive;
+    if (keep_alive->enable)
+    {
+        LISTEN_ON_SOCKOPT(true, SOL_SOCKET, SO_KEEPALIVE, 1, "keepalive");
+        LISTEN_ON_SOCKOPT(keep_alive->time, SOL_TCP, TCP_KEEPIDLE, keep_alive->time, "keepidle");
+        LISTEN_ON_SOCKOPT(keep_alive->probes, SOL_TCP, TCP_KEEPCNT, keep_alive->probes, "keepcnt");
+        LISTEN_ON_SOCKOPT(keep_alive->interval, SOL_TCP, TCP_KEEPINTVL, keep_alive->interval, "keepintv");
+    }
+
+    /* forced ones fall back to regular on EPERM, see set_sol_force */
+    LISTEN_ON_SOCKOPT(lo->recv_buffer && !lo->buffer_force, SOL_SOCKET, SO_RCVBUF, lo->recv_buffer, "rcv");
+    LISTEN_ON_SOCKOPT(lo->send_buffer && !lo->buffer_force, SOL_SOCKET, SO_SNDBUF, lo->send_buffer, "snd");
+    LISTEN_ON_SOCKOPT(lo->rxq_overflow, SOL_SOCKET, SO_RXQ_OVFL, 1, "SO_RXQ_OVFL");
+
+    /* before bind, so first packet already has it; accepted sockets inherit */
+    LISTEN_ON_SOCKOPT(lo->timestamp_ns, SOL_SOCKET, SO_TIMESTAMPNS, 1, "SO_TIMESTAMPNS");
+    const uint32_t timestamping = listen_on_is_tcp(lo)
+        ? lo->timestamping & ~(uint32_t)SOF_TIMESTAMPING_OPT_ID
+        : lo->timestamping;
+    LISTEN_ON_SOCKOPT(timestamping, SOL_SOCKET, SO_TIMESTAMPING, timestamping, "SO_TIMESTAMPING");
+
+    /* UDP only, silently skip everything else */
+    if (listen_on_is_udp(lo))
+    {
+        LISTEN_ON_SOCKOPT(lo->udp_gro, SOL_UDP, UDP_GRO, 1, "UDP_GRO");
+        LISTEN_ON_SOCKOPT(lo->udp_segment, SOL_UDP, UDP_SEGMENT, lo->udp_segment, "UDP_SEGMENT");
+    }
+
+    LISTEN_ON_SOCKOPT(lo->busy_poll_usec, SOL_SOCKET, SO_BUSY_POLL, lo->busy_poll_usec, "SO_BUSY_POLL");
+    LISTEN_ON_SOCKOPT(lo->prefer_busy_poll, SOL_SOCKET, SO_PREFER_BUSY_POLL, 1, "SO_PREFER_BUSY_POLL");
+    /* budget above net.core.busy_poll_budget needs CAP_NET_ADMIN */
+    LISTEN_ON_SOCKOPT(lo->busy_poll_budget, SOL_SOCKET, SO_BUSY_POLL_BUDGET, lo->busy_poll_budget, "SO_BUSY_POLL_BUDGET");
+    LISTEN_ON_SOCKOPT(lo->incoming_cpu_set, SOL_SOCKET, SO_INCOMING_CPU, lo->incoming_cpu, "SO_INCOMING_CPU");
+    LISTEN_ON_SOCKOPT(lo->defer_accept, SOL_TCP, TCP_DEFER_ACCEPT, lo->defer_accept, "TCP_DEFER_ACCEPT");
+    LISTEN_ON_SOCKOPT(lo->fast_open, SOL_TCP, TCP_FASTOPEN, lo->fast_open, "TCP_FASTOPEN");
+    LISTEN_ON_SOCKOPT(lo->no_delay && lo->socket_type == SOCK_STREAM && lo->addr.ss_family != AF_UNIX,
+        SOL_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+
+#undef LISTEN_ON_SOCKOPT
+    return count;
+}
+
+static int listen_on_sockopts_only(const struct listen_on *lo)
+{
+    /*
+        Everything listen_on_set_fd_options does on top of listen_on_sockopts.
+        Whole ReusePortGroup stays out too, leader with steering program has
+        to be bound first, clones join its group in list order.
+    */
+    return !lo->reuse_port_steered
+        && !((lo->recv_buffer || lo->send_buffer) && lo->buffer_force)
+        && !lo->ttl
+        && !lo->tos
+        && !lo->dscp
+        && !lo->fast_open_key
+        && !lo->socket_filter
+        && !lo->socket_filter_bpf
+        && !lo->reuse_port_migrate;
+}
+
+static int listen_on_set_fd_options(const struct listen_on *lo)
+{
+    int fd = lo->fd;
+
+    struct sockopt opts[LISTEN_ON_SOCKOPTS_MAX];
+    const int count = listen_on_sockopts(lo, opts);
+    for (int i = 0; i < count; ++i)
+    {
+        if (setsockopt(fd, opts[i].level, opts[i].name, &opts[i].value, sizeof(opts[i].value)))
+        {
+            perror(opts[i].what);
+            fprintf(stderr, "Unable to set %s to %u on %s\n", opts[i].what, opts[i].value, lo->socket_listen);
+            return 1;
+        }
+    }
+
+    /* needs SO_REUSEPORT already set */
+    if (lo->reuse_port_group > 1 && set_reuseport_cpu_steering(fd, lo->reuse_port_group))
+    {
+        perror("SO_ATTACH_REUSEPORT_CBPF");
+        return 1;
+    }
+
+    if (lo->recv_buffer && lo->buffer_force
+        && set_sol_force(fd, SO_RCVBUF, SO_RCVBUFFORCE, lo->recv_buffer))
+    {
+        perror("rcv");
+        return 1;
+    }
+
+    if (lo->send_buffer && lo->buffer_force
+        && set_sol_force(fd, SO_SNDBUF, SO_SNDBUFFORCE, lo->send_buffer))
+    {
+        perror("snd");
+        return 1;
+    }
+
+    if (lo->ttl && set_ttl(fd, lo->ttl))
+    {
+        perror("ttl");
+        return 1;
+    }
+
+    if (lo->tos && set_tos(fd, lo->tos))
+    {
+        perror("tos");
+        return 1;
+    }
+
+    /* ToS is deprecated, so ensure dscp is set after it  in case where
+       both values are present
+    */
+    if (lo->dscp && set_dscp(fd, lo->dscp))
+    {
+        perror("DSCP");
+        return 1;
+    }
+
+    if (lo->fast_open_key && set_fast_open_key(fd, lo->fast_open_key))
+    {
+        perror("TCP_FASTOPEN_KEY");
+        fprintf(stderr, "Unable to set Fast Open key from %s\n", lo->fast_open_key);
+        return 1;
+    }
+
+    /* before bind, nothing slips through unfiltered */
+    if (lo->socket_filter && set_socket_filter(fd, lo->socket_filter))
+    {
+        perror("SO_ATTACH_FILTER");
+        fprintf(stderr, "Unable to attach socket filter from %s\n", lo->socket_filter);
+        return 1;
+    }
+
+    if (lo->socket_filter_bpf && set_socket_filter_bpf(fd, lo->socket_filter_bpf))
+    {
+        perror("SO_ATTACH_BPF");
+        fprintf(stderr, "Unable to attach socket filter pinned at %s\n", lo->socket_filter_bpf);
+        return 1;
+    }
+
+    /* app inherits listener, it must not be able to drop the filter */
+    if ((lo->socket_filter || lo->socket_filter_bpf) && set_sol(fd, SO_LOCK_FILTER, 1))
+    {
+        perror("SO_LOCK_FILTER");
+        return 1;
+    }
+
+    return 0;
+}
+
+/* arguments impl */
+
+static struct listen_on *arguments_obtain_listen_on(struct arguments *args)
+{
+    if (args->listeners_tail == NULL)
+    {
+        args->listeners_tail = &args->listeners;
+        return &args->listeners;
+    }
+    args->listeners_tail = listen_on_new(args->listeners_tail);
+    return args->listeners_tail;
+}
+
+static void arguments_free(struct arguments *args)
+{
+    /* use next, base is not malloced */
+    listen_on_free(args->listeners.next);
+    free(args->listeners.fd_name);
+}
+
+static int arguments_create_path(const char *path, const struct arguments *arguments)
+{
+    /* sun_path or FIFO path, latter is not limited to sizeof(sun_path) */
+    char path_dup[PATH_MAX];
+    if (strlen(path) >= sizeof(path_dup))
+    {
+        fprintf(stderr, "Path too long: %s\n", path);
+        return 1;
+    }
+    // NOLINTNEXTLINE: insecure, srecure
+    strncpy(path_dup, path, sizeof(path_dup));
+
+    char *dirs = dirname(path_dup);
+    char *tok_state = NULL;
+    // Root '/' is expected to be created by someone else
+    int dir_fd = open_or_mkdir(-1, "/", 0);
+    if (dir_fd < 0)
+    {
+        perror("root open failed");
+        return 1;
+    }
+
+    char *tok = strtok_r(dirs, "/", &tok_state);
+    while (tok != NULL)
+    {
+        errno = 0;
+        int new_fd = open_or_mkdir(dir_fd, tok, arguments->directory_mode);
+        if (new_fd < 0)
+        {
+            perror("dirdasz");
+            return 1;
+        }
+        close(dir_fd);
+        dir_fd = new_fd;
+
+        /* advance to next token */
+        tok = strtok_r(NULL, "/", &tok_state);
+    }
+    close(dir_fd);
+    return 0;
+}
+
+static void arguments_exec(const struct arguments *args, char *const app_argv[])
+{
+    /* mimic systemd, LISTEN_PID is always the app itself */
+    char tmp[16] = {0};
+    snprintf(tmp, sizeof(tmp) - 1, "%d", getpid()); /* NOLINT */
+    setenv("LISTEN_PID", tmp, 1);
+
+    if (profile_apply(&args->profile))
+    {
+        return;
+    }
+
+    execv(args->app_to_run, app_argv);
+    perror("execv");
+}
+
+/* exec_profile impl */
+
+static int profile_apply_limits(const struct exec_profile *profile)
+{
+    if (profile->nofile_set && setrlimit(RLIMIT_NOFILE, &profile->nofile))
+    {
+        perror("LimitNOFILE");
+        return 1;
+    }
+
+    if (profile->memlock_set && setrlimit(RLIMIT_MEMLOCK, &profile->memlock))
+    {
+        perror("LimitMEMLOCK");
+        return 1;
+    }
+    return 0;
+}
+
+static int profile_apply(const struct exec_profile *profile)
+{
+    /* limits are set by launcher already, inherited */
+
+    if (profile->oom_score_adjust_set)
+    {
+        FILE *f = fopen("/proc/self/oom_score_adj", "we");
+        if (f == NULL || fprintf(f, "%d", profile->oom_score_adjust) < 0 || fclose(f))
+        {
+            perror("OOMScoreAdjust");
+            return 1;
+        }
+    }
+
+    if (profile->nice_set && setpriority(PRIO_PROCESS, 0, profile->nice))
+    {
+        perror("Nice");
+        return 1;
+    }
+
+    if (profile->sched_policy >= 0)
+    {
+        const int realtime = profile->sched_policy == SCHED_FIFO || profile->sched_policy == SCHED_RR;
+        struct sched_param param = {
+            .sched_priority = realtime ? (profile->sched_priority ? profile->sched_priority : 1) : 0,
+        };
+        if (sched_setscheduler(0, profile->sched_policy, &param))
+        {
+            perror("CPUSchedulingPolicy");
+            return 1;
+        }
+    }
+
+    if (profile->io_class >= 0)
+    {
+        const int ioprio = profile->io_class << IOPRIO_CLASS_SHIFT | (profile->io_class ? profile->io_priority : 0);
+        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio))
+        {
+            perror("IOSchedulingClass");
+            return 1;
+        }
+    }
+
+    /* both survive execve */
+    if (profile->timer_slack_ns && prctl(PR_SET_TIMERSLACK, profile->timer_slack_ns, 0, 0, 0))
+    {
+        perror("TimerSlackNSec");
+        return 1;
+    }
+
+    if (profile->thp
+        && prctl(PR_SET_THP_DISABLE, 1, profile->thp == THP_MADVISE ? PR_THP_DISABLE_EXCEPT_ADVISED : 0, 0, 0))
+    {
+        perror("TransparentHugePages");
+        return 1;
+    }
+
+    return 0;
+}
+
+static int profile_cgroup_setup(struct exec_profile *profile)
+{
+    char root[PATH_MAX] = {0};
+    if (cgroup2_mount_point(root, sizeof(root)))
+    {
+        fprintf(stderr, "Slice needs cgroup2 mounted\n");
+        return 1;
+    }
+
+    /* controllers have to be enabled all the way down */
+    char controllers[64] = {0};
+    /* NOLINTNEXTLINE */
+    snprintf(controllers, sizeof(controllers), "%s%s%s%s",
+             profile->cpu_weight || profile->cpu_quota_percent ? " +cpu" : "",
+             profile->memory_high || profile->memory_max ? " +memory" : "",
+             profile->io_weight ? " +io" : "",
+             profile->allowed_cpus ? " +cpuset" : "");
+
+    int dir = open(root, O_CLOEXEC | O_DIRECTORY | O_RDONLY);
+    if (dir < 0)
+    {
+        perror(root);
+        return 1;
+    }
+
+    char path[PATH_MAX] = {0};
+    strncpy(path, profile->slice, sizeof(path) - 1);
+    char *tok_state = NULL;
+    for (char *tok = strtok_r(path, "/", &tok_state); tok != NULL; tok = strtok_r(NULL, "/", &tok_state))
+    {
+        /* already enabled ones are no-op, so it works with processes in parent too */
+        if (controllers[0] && cgroup_write(dir, "cgroup.subtree_control", controllers + 1))
+        {
+            perror("cgroup.subtree_control");
+            fprintf(stderr, "Unable to enable%s above %s in %s\n", controllers, tok, root);
+            close(dir);
+            return 1;
+        }
+
+        const int next = open_or_mkdir(dir, tok, 0755);
+        close(dir);
+        if (next < 0)
+        {
+            perror(tok);
+            fprintf(stderr, "Unable to create Slice %s in %s\n", profile->slice, root);
+            return 1;
+        }
+        dir = next;
+    }
+
+    char value[64] = {0};
+    int failed = 0;
+#define CGROUP_SET(cond, file, ...) \
+    if (!failed && (cond)) \
+    { \
+        snprintf(value, sizeof(value), __VA_ARGS__); /* NOLINT */ \
+        if (cgroup_write(dir, (file), value)) \
+        { \
+            perror(file); \
+            fprintf(stderr, "Unable to set %s of Slice %s\n", (file), profile->slice); \
+            failed = 1; \
+        } \
+    }
+
+    CGROUP_SET(profile->cpu_weight, "cpu.weight", "%d", profile->cpu_weight);
+    /* quota in usec per 100ms period */
+    CGROUP_SET(profile->cpu_quota_percent, "cpu.max", "%u 100000", profile->cpu_quota_percent * 1000);
+    CGROUP_SET(profile->memory_high == RLIM_INFINITY, "memory.high", "max");
+    CGROUP_SET(profile->memory_high && profile->memory_high != RLIM_INFINITY, "memory.high", "%" PRIu64,
+               (uint64_t)profile->memory_high);
+    CGROUP_SET(profile->memory_max == RLIM_INFINITY, "memory.max", "max");
+    CGROUP_SET(profile->memory_max && profile->memory_max != RLIM_INFINITY, "memory.max", "%" PRIu64,
+               (uint64_t)profile->memory_max);
+    CGROUP_SET(profile->io_weight, "io.weight", "default %d", profile->io_weight);
+    CGROUP_SET(profile->allowed_cpus, "cpuset.cpus", "%s", profile->allowed_cpus);
+
+#undef CGROUP_SET
+    if (failed)
+    {
+        close(dir);
+        return 1;
+    }
+
+    profile->cgroup_fd = dir;
+    return 0;
+}
+
+static int profile_cgroup_join(const struct exec_profile *profile)
+{
+    /* "0" is whoever writes it */
+    if (profile->cgroup_fd >= 0 && cgroup_write(profile->cgroup_fd, "cgroup.procs", "0"))
+    {
+        perror("cgroup.procs");
+        fprintf(stderr, "Unable to move into Slice %s\n", profile->slice);
+        return 1;
+    }
+    return 0;
+}
+
+static pid_t profile_fork(const struct exec_profile *profile)
+{
+    if (profile->cgroup_fd < 0)
+    {
+        return fork();
+    }
+
+    /* child never runs outside of Slice, 5.7+ */
+    struct clone_args clone_args = {
+        .flags = CLONE_INTO_CGROUP,
+        .exit_signal = SIGCHLD,
+        .cgroup = (uint64_t)profile->cgroup_fd,
+    };
+    pid_t pid = (pid_t)syscall(SYS_clone3, &clone_args, sizeof(clone_args));
+    if (pid >= 0 || (errno != ENOSYS && errno != E2BIG))
+    {
+        return pid;
+    }
+
+    /*
+        Parent moves child, so failure is reported to the caller like failed
+        fork and child is never counted as started. Child waits until then,
+        nothing it does should happen outside of Slice.
+    */
+    int moved[2];
+    if (pipe2(moved, O_CLOEXEC))
+    {
+        return -1;
+    }
+
+    pid = fork();
+    if (pid == 0)
+    {
+        close(moved[1]);
+        char byte = 0;
+        ssize_t n = 0;
+        do
+        {
+            n = read(moved[0], &byte, 1);
+        } while (n < 0 && errno == EINTR);
+        if (n != 1)
+        {
+            _exit(127);
+        }
+        close(moved[0]);
+        return 0;
+    }
+    close(moved[0]);
+    if (pid < 0)
+    {
+        close(moved[1]);
+        return -1;
+    }
+
+    char value[16];
+    /* NOLINTNEXTLINE */
+    snprintf(value, sizeof(value), "%d", pid);
+    if (cgroup_write(profile->cgroup_fd, "cgroup.procs", value))
+    {
+        const int saved = errno;
+        fprintf(stderr, "Unable to move pid=%d into Slice %s\n", pid, profile->slice);
+        close(moved[1]);
+        waitpid(pid, NULL, 0);
+        errno = saved;
+        return -1;
+    }
+
+    (void)!write(moved[1], "1", 1);
+    close(moved[1]);
+    return pid;
+}
+
+static int cgroup_write(int dir, const char *file, const char *value)
+{
+    int fd = openat(dir, file, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    const ssize_t len = (ssize_t)strlen(value);
+    const int ret = write(fd, value, len) == len ? 0 : -1;
+    const int saved = errno;
+    close(fd);
+    errno = saved;
+    return ret;
+}
+
+static int cgroup2_mount_point(char *out, size_t size)
+{
+    /* /sys/fs/cgroup, or /sys/fs/cgroup/unified on hybrid systems */
+    FILE *f = fopen("/proc/self/mounts", "re");
+    if (f == NULL)
+    {
+        return 1;
+    }
+
+    char line[1024];
+    int found = 0;
+    while (!found && fgets(line, sizeof(line), f))
+    {
+        char dir[PATH_MAX];
+        char type[32];
+        if (sscanf(line, "%*s %4095s %31s", dir, type) == 2 && strcmp(type, "cgroup2") == 0 && strlen(dir) < size)
+        {
+            strcpy(out, dir);
+            found = 1;
+        }
+    }
+    fclose(f);
+    return !found;
+}
+
+/* parsers impl */
+
+static int parse_ulong(const char *v, const int base, unsigned long *out)
+{
+    char *end = NULL;
+    *out = strtoul(v, &end, base);
+    if (errno != 0)
+    {
+        return errno;
+    }
+
+    /* check if whole string was parsed */
+    if (end == NULL || strlen(end) > 0)
+    {
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+static int parse_int(const char *v, int *out)
+{
+    unsigned long parsed = 0;
+    if (parse_ulong(v, 10, &parsed))
+    {
+        return EINVAL;
+    }
+    *out = (int)parsed;
+    return 0;
+}
+
+static int parse_uint32(const char *v, uint32_t *out)
+{
+    unsigned long parsed = 0;
+    if (parse_ulong(v, 10, &parsed))
+    {
+        return EINVAL;
+    }
+
+    if (parsed < 0)
+    {
+        return EINVAL;
+    }
+
+    if (parsed > 0xFFFFFFFF)
+    {
+        return EINVAL;
+    }
+
+    *out = (uint32_t)parsed;
+
+    return 0;
+}
+
+static int parse_bool(const char *v, int *out)
+{
+    size_t len = strlen(v);
+    if (len == 0)
+    {
+        return EINVAL;
+    }
+    // YES, this will pass yeti, and turban as true
+    if (*v == '1' || tolower(*v) == 't' || tolower(*v) == 'y')
+    {
+        *out = 1;
+        return 0;
+    }
+    *out = 0;
+    return 0;
+}
+
+static int parse_msec(const char *v, uint32_t *out)
+{
+    /* seconds, fractions allowed: 0.1, 5, 2.5 */
+    char *end = NULL;
+    errno = 0;
+    double parsed = strtod(v, &end);
+    if (errno != 0 || end == v || strlen(end) > 0 || parsed < 0 || parsed > 0xFFFFFFFF / 1000.0)
+    {
+        fprintf(stderr, "value (%s) not valid number of seconds\n", v);
+        return EINVAL;
+    }
+
+    *out = (uint32_t)(parsed * 1000);
+    return 0;
+}
+
+static int parse_user(const char *v, uid_t *user)
+{
+    unsigned long parsed = 0;
+
+    fprintf(stderr, "Try parse user: %s\n", v);
+
+    // this might be 'human readable' or number
+    struct passwd *result = getpwnam(v);
+    if (result != NULL)
+    {
+        *user = result->pw_uid;
+        fprintf(stderr, "found user %d\n", *user);
+        return 0;
+    }
+
+    if (parse_ulong(v, 10, &parsed))
+    {
+        goto err;
+    }
+
+    *user = parsed;
+    return 0;
+
+err:
+    fprintf(stderr, "not known user: %s\n", v);
+    return EINVAL;
+}
+
+static int parse_group(const char *v, gid_t *group)
+{
+    unsigned long parsed = 0;
+
+    if (parse_ulong(v, 10, &parsed))
+    {
+        goto err;
+    }
+
+    return 0;
+err:
+    return EINVAL;
+}
+
+static int parse_mode(const char *v, mode_t *mode)
+{
+    const mode_t MAX_MODE = S_IRWXU | S_IRWXG | S_IRWXO;
+    unsigned long parsed = 0;
+    if (parse_ulong(v, 8, &parsed))
+    {
+        goto err;
+    }
+
+    if (parsed > MAX_MODE)
+    {
+        goto err;
+    }
+
+    *mode = (mode_t)parsed;
+    return 0;
+
+err:
+    fprintf(stderr, "value (%s) not valid mode\n", v);
+    return EINVAL;
+}
+
+static int parse_ushort(const char *v, unsigned short *out)
+{
+    unsigned long parsed = 0;
+    if (parse_ulong(v, 10, &parsed))
+    {
+        return EINVAL;
+    }
+
+    if (parsed > 0xFFFF)
+    {
+        return EINVAL;
+    }
+
+    *out = (unsigned short)parsed;
+    return 0;
+}
+
+static int parse_port_range(const char *v, unsigned short *first, uint16_t *last)
+{
+    /* FIRST-LAST, both inclusive */
+    const char *dash = strchr(v, '-');
+    if (dash == NULL || dash == v || (size_t)(dash - v) >= 6)
+    {
+        return EINVAL;
+    }
+
+    char first_dup[6] = {0};
+    strncpy(first_dup, v, dash - v);
+
+    unsigned short last_port = 0;
+    if (parse_ushort(first_dup, first) || parse_ushort(dash + 1, &last_port))
+    {
+        return EINVAL;
+    }
+
+    if (last_port < *first)
+    {
+        fprintf(stderr, "Port range is backwards: %s\n", v);
+        return EINVAL;
+    }
+
+    *last = last_port == *first ? 0 : last_port;
+    return 0;
+}
+
+static int parse_group_size(const char *v, uint32_t *out)
+{
+    if (strcmp(v, "auto") == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cpus < 1)
+        {
+            perror("sysconf");
+            return EINVAL;
+        }
+        *out = (uint32_t)cpus;
+        return 0;
+    }
+
+    if (parse_uint32(v, out) || *out == 0)
+    {
+        fprintf(stderr, "value (%s) not valid group size\n", v);
+        return EINVAL;
+    }
+    return 0;
+}
+
+static int parse_power_of_2(const char *v, uint32_t min, uint32_t max, uint32_t *out)
+{
+    uint32_t parsed = 0;
+    if (parse_uint32(v, &parsed) || parsed < min || parsed > max || (parsed & (parsed - 1)))
+    {
+        fprintf(stderr, "value (%s) must be power of 2 in range %u..%u\n", v, min, max);
+        return EINVAL;
+    }
+    *out = parsed;
+    return 0;
+}
+
+static int parse_int_range(const char *v, int min, int max, int *out)
+{
+    char *end = NULL;
+    errno = 0;
+    long parsed = strtol(v, &end, 10);
+    if (errno || end == v || *end != '\0' || parsed < min || parsed > max)
+    {
+        fprintf(stderr, "Expected number between %d and %d: %s\n", min, max, v);
+        return EINVAL;
+    }
+    *out = (int)parsed;
+    return 0;
+}
+
+static int parse_name_value(const char *v, const struct name_value *items, const char *what, int *out)
+{
+    for (const struct name_value *item = items; item->name; ++item)
+    {
+        if (strcmp(item->name, v) == 0)
+        {
+            *out = item->value;
+            return 0;
+        }
+    }
+    fprintf(stderr, "Unknown %s: %s\n", what, v);
+    return EINVAL;
+}
+
+static int parse_size(const char *v, uint64_t *out)
+{
+    char *end = NULL;
+    errno = 0;
+    unsigned long long parsed = strtoull(v, &end, 10);
+    if (errno || end == v || *v == '-')
+    {
+        return EINVAL;
+    }
+
+    /* K, M, G, T: 1024 based, as in systemd */
+    const char *suffixes = "KMGT";
+    const char *suffix = *end ? strchr(suffixes, *end) : NULL;
+    if (*end && (suffix == NULL || end[1] != '\0'))
+    {
+        return EINVAL;
+    }
+    for (const char *p = suffixes; suffix && p <= suffix; ++p)
+    {
+        parsed <<= 10;
+    }
+    *out = parsed;
+    return 0;
+}
+
+static int parse_rlimit_value(const char *v, rlim_t *out)
+{
+    if (strcmp(v, "infinity") == 0)
+    {
+        *out = RLIM_INFINITY;
+        return 0;
+    }
+
+    uint64_t parsed = 0;
+    if (parse_size(v, &parsed))
+    {
+        return EINVAL;
+    }
+    *out = (rlim_t)parsed;
+    return 0;
+}
+
+static int parse_rlimit(const char *v, struct rlimit *out)
+{
+    /* SOFT[:HARD], single value sets both */
+    char soft[32] = {0};
+    const char *colon = strchr(v, ':');
+    const size_t soft_len = colon ? (size_t)(colon - v) : strlen(v);
+    if (soft_len == 0 || soft_len >= sizeof(soft))
+    {
+        fprintf(stderr, "Invalid limit: %s\n", v);
+        return EINVAL;
+    }
+    memcpy(soft, v, soft_len);
+
+    if (parse_rlimit_value(soft, &out->rlim_cur) || parse_rlimit_value(colon ? colon + 1 : soft, &out->rlim_max))
+    {
+        fprintf(stderr, "Invalid limit: %s\n", v);
+        return EINVAL;
+    }
+
+    if (out->rlim_cur > out->rlim_max)
+    {
+        fprintf(stderr, "Soft limit above hard one: %s\n", v);
+        return EINVAL;
+    }
+    return 0;
+}
+
+static int parse_timestamping(const char *v, struct listen_on *lo)
+{
+    /* FLAG[,FLAG...], adds to what previous --Timestamping set */
+    while (*v)
+    {
+        char flag[32] = {0};
+        const char *comma = strchr(v, ',');
+        const size_t len = comma ? (size_t)(comma - v) : strlen(v);
+        if (len == 0 || len >= sizeof(flag))
+        {
+            fprintf(stderr, "Invalid timestamping flag in: %s\n", v);
+            return EINVAL;
+        }
+        memcpy(flag, v, len);
+
+        int value = 0;
+        if (strcmp(flag, "ns") == 0)
+        {
+            lo->timestamp_ns = true;
+        }
+        else if (parse_name_value(flag, timestamping_flags, "timestamping flag", &value) == 0)
+        {
+            lo->timestamping |= (uint32_t)value;
+        }
+        else
+        {
+            return EINVAL;
+        }
+        v += comma ? len + 1 : len;
+    }
+    return 0;
+}
+
+static int parse_xdp(const char *v, struct listen_on *lo)
+{
+    /* IFNAME:QUEUE:PORT */
+    char ifname[IF_NAMESIZE] = {0};
+    const char *p_queue = strchr(v, ':');
+    if (p_queue == NULL || (size_t)(p_queue - v) >= sizeof(ifname))
+    {
+        fprintf(stderr, "expected IFNAME:QUEUE:PORT: %s\n", v);
+        return EINVAL;
+    }
+    memcpy(ifname, v, p_queue - v);
+
+    const char *p_port = strchr(p_queue + 1, ':');
+    if (p_port == NULL)
+    {
+        fprintf(stderr, "expected IFNAME:QUEUE:PORT: %s\n", v);
+        return EINVAL;
+    }
+
+    char queue_text[16] = {0};
+    if ((size_t)(p_port - p_queue - 1) >= sizeof(queue_text))
+    {
+        return EINVAL;
+    }
+    memcpy(queue_text, p_queue + 1, p_port - p_queue - 1);
+
+    struct sockaddr_xdp *sxdp = (struct sockaddr_xdp *)&lo->addr;
+    sxdp->sxdp_family = AF_XDP;
+    sxdp->sxdp_ifindex = if_nametoindex(ifname);
+    if (sxdp->sxdp_ifindex == 0)
+    {
+        perror("if_nametoindex");
+        fprintf(stderr, "Unknown interface: %s\n", ifname);
+        return EINVAL;
+    }
+
+    if (parse_uint32(queue_text, &sxdp->sxdp_queue_id) || parse_ushort(p_port + 1, &lo->xdp_port))
+    {
+        fprintf(stderr, "expected IFNAME:QUEUE:PORT: %s\n", v);
+        return EINVAL;
+    }
+
+    lo->kind = LISTEN_ON_XDP;
+    lo->addr_len = sizeof(*sxdp);
+    lo->socket_type = SOCK_RAW;
+    lo->socket_listen = v;
+    /* no SOCK_CLOEXEC, app inherits it like any listener */
+    lo->fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (lo->fd < 0)
+    {
+        perror("socket");
+        return errno;
+    }
+
+    if (asprintf(&lo->fd_name, "xsk-%s-%u", ifname, sxdp->sxdp_queue_id) < 0)
+    {
+        return ENOMEM;
+    }
+    return 0;
+}
+
+static int parse_addr(const char *v, struct listen_on *lo)
+{
+    unsigned short port = 0;
+
+    if (parse_ushort(v, &port) == 0 || parse_port_range(v, &port, &lo->port_range_last) == 0)
+    {
+        // Good, only port (or port range) listen on any address
+        struct sockaddr_in *in = (struct sockaddr_in *)&lo->addr;
+        lo->addr_len = sizeof(struct sockaddr_in);
+
+        in->sin_port = htons(port);
+        in->sin_family = AF_INET;
+        in->sin_addr.s_addr = htonl(INADDR_ANY);
+
+        goto ok;
+    }
+
+    size_t v_len = strlen(v);
+    if (v_len < 2)
+    {
+        return EINVAL;
+    }
+
+    // try parsing as unix socket
+    lo->addr_len = offsetof(struct sockaddr_un, sun_path) + v_len + 1;
+    // lo->socket_domain = AF_UNIX;
+    struct sockaddr_un *unix_addr = (struct sockaddr_un *)&lo->addr;
+    unix_addr->sun_family = AF_UNIX;
+
+    if (v[0] == '/' && v_len >= sizeof(unix_addr->sun_path))
+    {
+        fprintf(stderr, "Path too long: %s\n", v);
+        return EINVAL;
+    }
+
+    if (v[0] == '/')
+    {
+        strncpy(unix_addr->sun_path, v, sizeof(unix_addr->sun_path) - 1);
+        goto ok;
+    }
+    else if (v[1] == '@')
+    {
+        lo->addr_len -= 1;
+        strncpy(unix_addr->sun_path + 1, v + 1, sizeof(unix_addr->sun_path) - 2);
+        goto ok;
+    }
+
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = lo->socket_type,
+        .ai_flags = AI_NUMERICHOST | AI_NUMERICSERV,
+    };
+    struct addrinfo *serverinfo = NULL;
+    struct addrinfo *p = NULL;
+
+    /* BUG(m): This will pearshape on IPv6 */
+    char *p_semicolon = strchr(v, ':');
+    if (p_semicolon == NULL)
+    {
+        fprintf(stderr, "missing port in endpoint\n");
+        goto err;
+    }
+
+    char v_dup[INET6_ADDRSTRLEN] = {0};
+    strncpy(v_dup, v, p_semicolon - v);
+
+    /* resolve first port of range, rest is cloned right before setup */
+    const char *service = p_semicolon + 1;
+    char first_port[6] = {0};
+    if (strchr(service, '-'))
+    {
+        if (parse_port_range(service, &port, &lo->port_range_last))
+        {
+            fprintf(stderr, "Invalid port range: %s\n", service);
+            goto err;
+        }
+        /* NOLINTNEXTLINE */
+        snprintf(first_port, sizeof(first_port), "%u", port);
+        service = first_port;
+    }
+
+    if (getaddrinfo(v_dup, service, &hints, &serverinfo))
+    {
+        if (errno)
+        {
+            perror("getaddrinfo");
+        }
+        else
+        {
+            fprintf(stderr, "Unable to resolve address: %s\n", v);
+        }
+        goto err;
+    }
+
+    // Get first and call it a day:
+    lo->addr_len = serverinfo->ai_addrlen;
+    memcpy(&lo->addr, serverinfo->ai_addr, serverinfo->ai_addrlen);
+
+    if (serverinfo->ai_family != lo->addr.ss_family)
+    {
+        fprintf(stderr, "Family missmatch\n");
+        exit(1);
+    }
+
+    if (serverinfo->ai_socktype != lo->socket_type)
+    {
+        fprintf(stderr, "SOCKTYPE missmatch\n");
+        exit(1);
+    }
+
+    if (lo->socket_protocol == 0)
+    {
+        lo->socket_protocol = serverinfo->ai_protocol;
+    }
+
+    freeaddrinfo(serverinfo);
+
+ok:
+    /* socket is created right before setup, parsing stays cheap */
+    lo->socket_listen = v;
+    lo->fd = -1;
+    return 0;
+
+err:
+    return EINVAL;
+}
+
+static int parse_connect(const char *v, struct listen_on *lo)
+{
+    /* ADDR[xN], unix socket path might contain x too, so only trailing digits count */
+    char addr[sizeof(((struct sockaddr_un *)0)->sun_path) + 16] = {0};
+    size_t addr_len = strlen(v);
+    const char *x = strrchr(v, 'x');
+    lo->connect_count = 1;
+    if (x && x[1] && strspn(x + 1, "0123456789") == strlen(x + 1))
+    {
+        if (parse_uint32(x + 1, &lo->connect_count) || lo->connect_count == 0)
+        {
+            fprintf(stderr, "Invalid number of connections: %s\n", v);
+            return EINVAL;
+        }
+        addr_len = x - v;
+    }
+    if (addr_len >= sizeof(addr))
+    {
+        fprintf(stderr, "Address too long: %s\n", v);
+        return EINVAL;
+    }
+    memcpy(addr, v, addr_len);
+
+    lo->socket_type = SOCK_STREAM;
+    if (parse_addr(addr, lo))
+    {
+        return EINVAL;
+    }
+    lo->kind = LISTEN_ON_CONNECT;
+    lo->socket_listen = v;
+
+    if (lo->port_range_last || ((lo->addr.ss_family == AF_INET || lo->addr.ss_family == AF_INET6) && listen_on_port(lo) == 0))
+    {
+        fprintf(stderr, "ConnectStream needs single port: %s\n", v);
+        return EINVAL;
+    }
+
+    /* ':' separates $LISTEN_FDNAMES */
+    if (asprintf(&lo->fd_name, "connect-%s", addr) < 0)
+    {
+        return ENOMEM;
+    }
+    for (char *c = lo->fd_name; *c; ++c)
+    {
+        *c = *c == ':' ? '-' : *c;
+    }
+    return 0;
+}
+
+static int parse_shared_memory(const char *v, struct listen_on *lo)
+{
+    /* NAME:SIZE[:hugetlb] */
+    const char *p_size = strchr(v, ':');
+    if (p_size == NULL || p_size == v || (size_t)(p_size - v) > 249)
+    {
+        fprintf(stderr, "expected NAME:SIZE[:hugetlb]: %s\n", v);
+        return EINVAL;
+    }
+
+    char size_text[32] = {0};
+    const char *p_flags = strchr(p_size + 1, ':');
+    const size_t size_len = p_flags ? (size_t)(p_flags - p_size - 1) : strlen(p_size + 1);
+    uint64_t size = 0;
+    if (size_len == 0 || size_len >= sizeof(size_text))
+    {
+        fprintf(stderr, "Invalid SharedMemory size: %s\n", v);
+        return EINVAL;
+    }
+    memcpy(size_text, p_size + 1, size_len);
+    if (parse_size(size_text, &size) || size == 0)
+    {
+        fprintf(stderr, "Invalid SharedMemory size: %s\n", v);
+        return EINVAL;
+    }
+
+    unsigned int flags = MFD_ALLOW_SEALING;
+    if (p_flags && strcmp(p_flags + 1, "hugetlb") == 0)
+    {
+        flags |= MFD_HUGETLB;
+    }
+    else if (p_flags)
+    {
+        fprintf(stderr, "Unknown SharedMemory flag: %s\n", p_flags + 1);
+        return EINVAL;
+    }
+
+    lo->fd_name = strndup(v, p_size - v);
+    if (lo->fd_name == NULL)
+    {
+        return ENOMEM;
+    }
+
+    /* no MFD_CLOEXEC, app inherits it like any listener */
+    lo->kind = LISTEN_ON_AUX;
+    lo->socket_listen = v;
+    lo->fd = memfd_create(lo->fd_name, flags);
+    if (lo->fd < 0)
+    {
+        perror("memfd_create");
+        return errno;
+    }
+
+    /* hugetlb: SIZE must be multiple of huge page size */
+    if (ftruncate(lo->fd, (off_t)size))
+    {
+        perror("SharedMemory ftruncate");
+        return errno;
+    }
+
+    /* app can rely on mapping never turning into SIGBUS, contents stay writable */
+    if (fcntl(lo->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL))
+    {
+        perror("F_ADD_SEALS");
+        return errno;
+    }
+    return 0;
+}
+
+static int parse_ip(const char *v, struct sockaddr_storage *out)
+{
+    struct sockaddr_in *in = (struct sockaddr_in *)out;
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)out;
+    if (inet_pton(AF_INET, v, &in->sin_addr) == 1)
+    {
+        in->sin_family = AF_INET;
+        return 0;
+    }
+    if (inet_pton(AF_INET6, v, &in6->sin6_addr) == 1)
+    {
+        in6->sin6_family = AF_INET6;
+        return 0;
+    }
+    fprintf(stderr, "Invalid IP address: %s\n", v);
+    return EINVAL;
+}
+
+static error_t parser(int key, char arg[], struct argp_state *state)
+{
+    struct arguments *arguments = state->input;
+    struct listen_on *lo = &arguments->listeners;
+
+    switch (key)
     {
     case ARG_DIRECTORY_MODE:
         return parse_mode(arg, &arguments->directory_mode);
@@ -747,9 +3033,23 @@ static error_t parser(int key, char arg[], struct argp_state *state)
         /* expecting octal number */
         return parse_mode(arg, &arguments->socket_mode);
     case ARG_SOCKET_USER:
-        return parse_user(arg, &arguments->user);
+    {
+        /* NSS lookup, might go as far as LDAP */
+        struct trace_event span = trace_begin("parse_user", arg, 0);
+        int ret = parse_user(arg, &arguments->user);
+        trace_end(&span);
+        return ret;
+    }
     case ARG_SOCKET_GROUP:
-        return parse_group(arg, &arguments->group);
+    {
+        struct trace_event span = trace_begin("parse_group", arg, 0);
+        int ret = parse_group(arg, &arguments->group);
+        trace_end(&span);
+        return ret;
+    }
+    case ARG_TRACE_STARTUP:
+        arguments->trace_startup = arg;
+        break;
     case ARG_BACKLOG:
         return parse_int(arg, &arguments->backlog);
     case ARG_LISTEN_STREAM:
@@ -757,9 +3057,107 @@ static error_t parser(int key, char arg[], struct argp_state *state)
         lo->socket_type = SOCK_STREAM;
         return parse_addr(arg, lo);
     case ARG_LISTEN_DATAGRAM:
-        lo->socket_type = SOCK_DGRAM;
         lo = arguments_obtain_listen_on(arguments);
+        lo->socket_type = SOCK_DGRAM;
         return parse_addr(arg, lo);
+    case ARG_LISTEN_XDP:
+        lo = arguments_obtain_listen_on(arguments);
+        return parse_xdp(arg, lo);
+    case ARG_CONNECT_STREAM:
+        lo = arguments_obtain_listen_on(arguments);
+        return parse_connect(arg, lo);
+    case ARG_CONNECT_SOURCE_ADDRESS:
+        return parse_ip(arg, &arguments->connect_source);
+    case ARG_CONNECT_TIMEOUT_SEC:
+        return parse_msec(arg, &arguments->connect_timeout_ms);
+    case ARG_NO_DELAY:
+        lo->no_delay = true;
+        break;
+    case ARG_FILE_DESCRIPTOR_STORE_MAX:
+        return parse_uint32(arg, &arguments->fd_store_max);
+    case ARG_SHARED_MEMORY:
+        lo = arguments_obtain_listen_on(arguments);
+        return parse_shared_memory(arg, lo);
+    case ARG_XDP_FRAME_SIZE:
+        return parse_power_of_2(arg, 2048, (uint32_t)sysconf(_SC_PAGESIZE), &arguments->xdp_frame_size);
+    case ARG_XDP_FRAME_COUNT:
+        return parse_uint32(arg, &arguments->xdp_frame_count);
+    case ARG_XDP_RING_SIZE:
+        return parse_power_of_2(arg, 1, 1 << 20, &arguments->xdp_ring_size);
+    case ARG_XDP_MODE:
+        if (strcmp(arg, "auto") == 0)
+        {
+            arguments->xdp_mode = 0;
+        }
+        else if (strcmp(arg, "native") == 0)
+        {
+            arguments->xdp_mode = XDP_FLAGS_DRV_MODE;
+        }
+        else if (strcmp(arg, "generic") == 0)
+        {
+            arguments->xdp_mode = XDP_FLAGS_SKB_MODE;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown XDPMode: %s\n", arg);
+            return EINVAL;
+        }
+        break;
+    case ARG_LISTEN_FIFO:
+        lo = arguments_obtain_listen_on(arguments);
+        if (arg[0] != '/')
+        {
+            fprintf(stderr, "ListenFIFO expects absolute path: %s\n", arg);
+            return EINVAL;
+        }
+        lo->kind = LISTEN_ON_FIFO;
+        lo->socket_listen = arg;
+        lo->fd = -1;
+        break;
+    case ARG_PIPE_SIZE:
+    {
+        uint64_t size = 0;
+        if (parse_size(arg, &size) || size == 0 || size > INT32_MAX)
+        {
+            fprintf(stderr, "Invalid PipeSize: %s\n", arg);
+            return EINVAL;
+        }
+        arguments->pipe_size = (uint32_t)size;
+        break;
+    }
+    case ARG_LISTEN_MESSAGE_QUEUE:
+        lo = arguments_obtain_listen_on(arguments);
+        /* one slash, at the start */
+        if (arg[0] != '/' || arg[1] == '\0' || strchr(arg + 1, '/'))
+        {
+            fprintf(stderr, "ListenMessageQueue expects /NAME: %s\n", arg);
+            return EINVAL;
+        }
+        lo->kind = LISTEN_ON_MQUEUE;
+        lo->socket_listen = arg;
+        lo->fd = -1;
+        break;
+    case ARG_MESSAGE_QUEUE_MAX_MESSAGES:
+    {
+        int value = 0;
+        if (parse_int_range(arg, 1, INT32_MAX, &value))
+        {
+            return EINVAL;
+        }
+        arguments->mq_max_messages = value;
+        break;
+    }
+    case ARG_MESSAGE_QUEUE_MESSAGE_SIZE:
+    {
+        uint64_t size = 0;
+        if (parse_size(arg, &size) || size == 0 || size > INT32_MAX)
+        {
+            fprintf(stderr, "Invalid MessageQueueMessageSize: %s\n", arg);
+            return EINVAL;
+        }
+        arguments->mq_message_size = (long)size;
+        break;
+    }
     case ARG_LISTEN_SEQ:
         lo = arguments_obtain_listen_on(arguments);
         lo->socket_type = SOCK_SEQPACKET;
@@ -772,184 +3170,3569 @@ static error_t parser(int key, char arg[], struct argp_state *state)
     case ARG_KEEP_ALIVE:
         lo->keep_alive.enable = true;
         break;
-    case ARG_KEEP_ALIVE_INTERVAL:
-        return parse_uint32(arg, &lo->keep_alive.interval);
-    case ARG_KEEP_ALIVE_PROBES:
-        return parse_uint32(arg, &lo->keep_alive.probes);
-    case ARG_KEEP_ALIVE_TIME:
-        return parse_uint32(arg, &lo->keep_alive.time);
-    case ARG_REUSE_ADDR:
-        lo->reuse_addr = true;
+    case ARG_KEEP_ALIVE_INTERVAL:
+        return parse_uint32(arg, &lo->keep_alive.interval);
+    case ARG_KEEP_ALIVE_PROBES:
+        return parse_uint32(arg, &lo->keep_alive.probes);
+    case ARG_KEEP_ALIVE_TIME:
+        return parse_uint32(arg, &lo->keep_alive.time);
+    case ARG_REUSE_ADDR:
+        lo->reuse_addr = true;
+        break;
+    case ARG_HANDOFF_SOCKET:
+        arguments->handoff_socket = arg;
+        break;
+    case ARG_INHERIT_FROM:
+        if (strlen(arg) >= sizeof(((struct sockaddr_un *)0)->sun_path))
+        {
+            fprintf(stderr, "InheritFrom path too long: %s\n", arg);
+            return EINVAL;
+        }
+        arguments->inherit_from = arg;
+        break;
+    case ARG_FREE_BIND:
+        lo->free_bind = true;
+        break;
+    case ARG_TRANSPARENT:
+        lo->transparent = true;
+        break;
+    case ARG_REUSE_PORT:
+        lo->reuse_port = true;
+        break;
+    case ARG_REUSE_PORT_MIGRATE:
+        lo->reuse_port = true;
+        lo->reuse_port_migrate = true;
+        break;
+    case ARG_BUFFER_FORCE:
+        lo->buffer_force = true;
+        break;
+    case ARG_UDP_GRO:
+        lo->udp_gro = true;
+        break;
+    case ARG_UDP_SEGMENT:
+        /* kernel keeps it as u16 */
+        if (parse_uint32(arg, &lo->udp_segment) || lo->udp_segment > 0xFFFF)
+        {
+            return EINVAL;
+        }
+        break;
+    case ARG_RECEIVE_QUEUE_OVERFLOW:
+        lo->rxq_overflow = true;
+        break;
+    case ARG_TIMESTAMPING:
+        return parse_timestamping(arg, lo);
+    case ARG_BUSY_POLL_USEC:
+        return parse_uint32(arg, &lo->busy_poll_usec);
+    case ARG_PREFER_BUSY_POLL:
+        lo->prefer_busy_poll = true;
+        break;
+    case ARG_BUSY_POLL_BUDGET:
+        return parse_uint32(arg, &lo->busy_poll_budget);
+    case ARG_INCOMING_CPU:
+        lo->incoming_cpu_set = true;
+        return parse_uint32(arg, &lo->incoming_cpu);
+    case ARG_DEFER_ACCEPT_SEC:
+        return parse_uint32(arg, &lo->defer_accept);
+    case ARG_FAST_OPEN:
+        return parse_uint32(arg, &lo->fast_open);
+    case ARG_FAST_OPEN_KEY:
+        lo->fast_open_key = arg;
+        break;
+    case ARG_SOCKET_FILTER:
+        lo->socket_filter = arg;
+        break;
+    case ARG_SOCKET_FILTER_BPF:
+        lo->socket_filter_bpf = arg;
+        break;
+    case ARG_SEND_BUFFER:
+        return parse_uint32(arg, &lo->send_buffer);
+    case ARG_RECEIVE_BUFFER:
+        return parse_uint32(arg, &lo->recv_buffer);
+    case ARG_IP_TOS:
+        // IPTOS_LOWDELAY and company
+        fprintf(stderr, "WARNING: ToS has been deprecated. Use DSCP\n");
+        return parse_uint32(arg, &lo->tos);
+    case ARG_IP_TTL:
+        return parse_uint32(arg, &lo->ttl);
+    case ARG_PRIORITY:
+        return parse_uint32(arg, &lo->priority);
+    case ARG_IP_DSCP:
+        return parse_uint32(arg, &lo->dscp);
+    case ARG_REUSE_PORT_GROUP:
+        return parse_group_size(arg, &arguments->reuse_port_group);
+    case ARG_FD_NAME:
+        if (strlen(arg) == 0 || strlen(arg) > 255 || strchr(arg, ':'))
+        {
+            fprintf(stderr, "Invalid file descriptor name: %s\n", arg);
+            return EINVAL;
+        }
+        arguments->fd_name = arg;
+        break;
+    case ARG_ON_DEMAND:
+        arguments->on_demand = 1;
+        break;
+    case ARG_IDLE_EXIT_SEC:
+        return parse_uint32(arg, &arguments->idle_exit_sec);
+    case ARG_ACCEPT:
+        return parse_bool(arg, &arguments->accept);
+    case ARG_MAX_CONNECTIONS:
+        return parse_uint32(arg, &arguments->max_connections);
+    case ARG_SPAWN_POOL:
+        return parse_uint32(arg, &arguments->spawn_pool);
+    case ARG_SUPERVISE:
+        arguments->supervise = 1;
+        break;
+    case ARG_WORKERS:
+        return parse_group_size(arg, &arguments->workers);
+    case ARG_RESTART_SEC:
+        return parse_msec(arg, &arguments->restart_ms);
+    case ARG_RESTART_MAX_DELAY_SEC:
+        return parse_msec(arg, &arguments->restart_max_ms);
+    case ARG_TYPE:
+        if (strcmp(arg, "notify") == 0)
+        {
+            arguments->notify = 1;
+        }
+        else if (strcmp(arg, "simple") == 0)
+        {
+            arguments->notify = 0;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown Type: %s\n", arg);
+            return EINVAL;
+        }
+        break;
+    case ARG_TIMEOUT_START_SEC:
+        return parse_msec(arg, &arguments->timeout_start_ms);
+    case ARG_METRICS_SOCKET:
+        arguments->metrics_socket = arg;
+        break;
+    case ARG_METRICS_FILE:
+        arguments->metrics_file = arg;
+        break;
+    case ARG_METRICS_INTERVAL_SEC:
+        /* 0 would rewrite file in a busy loop */
+        if (parse_msec(arg, &arguments->metrics_interval_ms) || arguments->metrics_interval_ms == 0)
+        {
+            fprintf(stderr, "Invalid MetricsIntervalSec, at least 1ms: %s\n", arg);
+            return EINVAL;
+        }
+        break;
+    case ARG_LIMIT_NOFILE:
+        arguments->profile.nofile_set = true;
+        return parse_rlimit(arg, &arguments->profile.nofile);
+    case ARG_LIMIT_MEMLOCK:
+        arguments->profile.memlock_set = true;
+        return parse_rlimit(arg, &arguments->profile.memlock);
+    case ARG_CPU_SCHEDULING_POLICY:
+        return parse_name_value(arg, sched_policies, "CPUSchedulingPolicy", &arguments->profile.sched_policy);
+    case ARG_CPU_SCHEDULING_PRIORITY:
+        return parse_int_range(arg, 1, 99, &arguments->profile.sched_priority);
+    case ARG_NICE:
+        arguments->profile.nice_set = true;
+        return parse_int_range(arg, -20, 19, &arguments->profile.nice);
+    case ARG_IO_SCHEDULING_CLASS:
+        return parse_name_value(arg, io_classes, "IOSchedulingClass", &arguments->profile.io_class);
+    case ARG_IO_SCHEDULING_PRIORITY:
+        return parse_int_range(arg, 0, 7, &arguments->profile.io_priority);
+    case ARG_TIMER_SLACK_NSEC:
+    {
+        unsigned long parsed = 0;
+        if (parse_ulong(arg, 10, &parsed) || parsed == 0)
+        {
+            fprintf(stderr, "Invalid TimerSlackNSec: %s\n", arg);
+            return EINVAL;
+        }
+        arguments->profile.timer_slack_ns = parsed;
+        break;
+    }
+    case ARG_TRANSPARENT_HUGE_PAGES:
+        return parse_name_value(arg, thp_modes, "TransparentHugePages", &arguments->profile.thp);
+    case ARG_OOM_SCORE_ADJUST:
+        arguments->profile.oom_score_adjust_set = true;
+        return parse_int_range(arg, -1000, 1000, &arguments->profile.oom_score_adjust);
+    case ARG_SLICE:
+        arguments->profile.slice = arg;
+        break;
+    case ARG_CPU_WEIGHT:
+        return parse_int_range(arg, 1, 10000, &arguments->profile.cpu_weight);
+    case ARG_CPU_QUOTA:
+    {
+        /* trailing % is optional */
+        const size_t len = strlen(arg);
+        if (len && arg[len - 1] == '%')
+        {
+            arg[len - 1] = '\0';
+        }
+        if (parse_uint32(arg, &arguments->profile.cpu_quota_percent) || arguments->profile.cpu_quota_percent == 0)
+        {
+            fprintf(stderr, "Invalid CPUQuota: %s\n", arg);
+            return EINVAL;
+        }
+        break;
+    }
+    case ARG_MEMORY_HIGH:
+        return parse_rlimit_value(arg, &arguments->profile.memory_high);
+    case ARG_MEMORY_MAX:
+        return parse_rlimit_value(arg, &arguments->profile.memory_max);
+    case ARG_IO_WEIGHT:
+        return parse_int_range(arg, 1, 10000, &arguments->profile.io_weight);
+    case ARG_ALLOWED_CPUS:
+        arguments->profile.allowed_cpus = arg;
+        break;
+    case ARG_SOCKET_PROTOCOL:
+        fprintf(stderr, "WARNING: Using SocketProtocol might result in hard to debug errors\n");
+        return parse_uint32(arg, &lo->socket_protocol);
+
+    case ARGP_KEY_ARG:
+        if (!state->quoted)
+        {
+            fprintf(stderr, "Application to run and it's arguments should be set after --\n");
+            return ARGP_ERR_UNKNOWN;
+        }
+        if (state->arg_num == 0)
+        {
+            arguments->app_to_run = arg;
+            arguments->copy_args_from = state->next - 1;
+            state->next = state->argc;
+            break;
+        }
+        fprintf(stderr, "SHOULD NET BE HERE: next=%d\n", state->next);
+        break;
+    case ARGP_KEY_END:
+        if (state->arg_num < 1)
+        {
+            // argp_err_exit_status = EINVAL;
+            argp_state_help(state, stdout, ARGP_HELP_STD_HELP | ARGP_HELP_EXIT_ERR);
+            argp_error(state, "missing whay you want to run");
+            return ARGP_ERR_UNKNOWN;
+        }
         break;
-    case ARG_REUSE_PORT:
-        lo->reuse_port = true;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/* startup trace impl */
+
+static uint64_t trace_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static struct trace_event trace_begin(const char *phase, const char *detail, uint16_t port)
+{
+    TRACE_PROBE_BEGIN(phase, detail, port);
+    return (struct trace_event){
+        .phase = phase,
+        .detail = detail,
+        .port = port,
+        .start_ns = startup_trace.enabled ? trace_now_ns() : 0,
+    };
+}
+
+static void trace_end(struct trace_event *span)
+{
+    TRACE_PROBE_END(span->phase, span->detail, span->port);
+    if (!startup_trace.enabled)
+    {
+        return;
+    }
+
+    span->end_ns = trace_now_ns();
+    if (startup_trace.size == startup_trace.capacity)
+    {
+        const size_t capacity = startup_trace.capacity ? startup_trace.capacity * 2 : 64;
+        struct trace_event *events = realloc(startup_trace.events, capacity * sizeof(*events));
+        if (events == NULL)
+        {
+            /* tracing must not break startup, stop recording instead */
+            startup_trace.enabled = false;
+            return;
+        }
+        startup_trace.events = events;
+        startup_trace.capacity = capacity;
+    }
+    startup_trace.events[startup_trace.size++] = *span;
+}
+
+static int trace_event_cmp(const void *a, const void *b)
+{
+    const struct trace_event *lhs = a;
+    const struct trace_event *rhs = b;
+    return (lhs->start_ns > rhs->start_ns) - (lhs->start_ns < rhs->start_ns);
+}
+
+static int trace_write(const char *path)
+{
+    FILE *out = fopen(path, "we");
+    if (out == NULL)
+    {
+        perror(path);
+        return 1;
+    }
+
+    /* recorded when phases end, nested ones (parse_user) end before outer */
+    qsort(startup_trace.events, startup_trace.size, sizeof(*startup_trace.events), trace_event_cmp);
+    const uint64_t origin = startup_trace.size ? startup_trace.events[0].start_ns : 0;
+    fprintf(out, "{\"pid\": %d, \"clock\": \"CLOCK_MONOTONIC\", \"origin_ns\": %" PRIu64 ", \"events\": [", getpid(), origin);
+    for (size_t i = 0; i < startup_trace.size; ++i)
+    {
+        const struct trace_event *e = &startup_trace.events[i];
+        fprintf(out, "%s\n  {\"phase\": \"%s\", \"detail\": \"", i ? "," : "", e->phase);
+        for (const char *c = e->detail; *c; ++c)
+        {
+            if (*c == '"' || *c == '\\')
+            {
+                fputc('\\', out);
+            }
+            fputc(isprint((unsigned char)*c) ? *c : '?', out);
+        }
+        fprintf(out, "\", \"port\": %u, \"start_ns\": %" PRIu64 ", \"offset_ns\": %" PRIu64 ", \"duration_ns\": %" PRIu64 "}",
+            e->port, e->start_ns, e->start_ns - origin, e->end_ns - e->start_ns);
+    }
+    fprintf(out, "\n]}\n");
+
+    /* written once, later spans are not recorded */
+    free(startup_trace.events);
+    startup_trace = (struct startup_trace){0};
+
+    if (fclose(out))
+    {
+        perror(path);
+        return 1;
+    }
+    return 0;
+}
+
+/* misc impl */
+
+static int open_or_mkdir(int fd, const char *name, mode_t mode)
+{
+    if (mkdirat(fd, name, mode) && errno != EEXIST)
+    {
+        return -1;
+    }
+
+    int dir = openat(fd, name, O_CLOEXEC | O_DIRECTORY | O_RDONLY);
+    return dir;
+}
+
+static int set_sol(int fd, int arg, uint32_t opt)
+{
+    return setsockopt(fd, SOL_SOCKET, arg, &opt, sizeof(opt));
+}
+
+static int set_sol_force(int fd, int arg, int force_arg, uint32_t opt)
+{
+    if (set_sol(fd, force_arg, opt) == 0)
+    {
+        return 0;
+    }
+
+    if (errno != EPERM)
+    {
+        return -1;
+    }
+
+    fprintf(stderr, "WARNING: no CAP_NET_ADMIN, buffer size capped by sysctl\n");
+    return set_sol(fd, arg, opt);
+}
+
+/* be warned: this is deprecated, and wild thing might happen */
+int set_tos(int fd, int tos)
+{
+    int masked = tos & IPTOS_TOS_MASK;
+    if (masked != tos)
+    {
+        fprintf(stderr, "Invalid tos value: %d (%d)\n", tos, masked);
+        return EINVAL;
+    }
+    return setsockopt(fd, IPPROTO_IP, IP_TOS, &masked, sizeof(masked));
+}
+
+int set_dscp(int fd, int val)
+{
+    if (val > 63)
+    {
+        return EINVAL;
+    }
+    /* shift: two first bits are ECN (Explicit Congestion Notification) */
+    val = val << 2;
+    int ret = setsockopt(fd, IPPROTO_IP, IP_TOS, &val, sizeof val);
+    /* might not be IPv4, try IPv6 */
+    if (ret)
+    {
+        return setsockopt(fd, IPPROTO_IPV6, IPV6_TCLASS, &val, sizeof val);
+    }
+    return 0;
+}
+
+int set_ttl(int fd, int ttl)
+{
+    int ret = setsockopt(fd, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl));
+    if (ret)
+    {
+        return setsockopt(fd, IPPROTO_IP, IPV6_HOPLIMIT, &ttl, sizeof(ttl));
+    }
+    return 0;
+}
+
+static int set_fast_open_key(int fd, const char *path)
+{
+    /* same as sysctl: 4x8 hex digits with '-', optional ',' and backup key */
+    char text[256] = {0};
+    int file = open(path, O_RDONLY | O_CLOEXEC);
+    if (file < 0)
+    {
+        return -1;
+    }
+    ssize_t n = read(file, text, sizeof(text) - 1);
+    close(file);
+    if (n < 0)
+    {
+        return -1;
+    }
+
+    uint8_t key[32] = {0};
+    size_t key_len = 0;
+    int nibble = -1;
+    for (const char *p = text; *p; ++p)
+    {
+        if (*p == '-' || *p == '\n' || *p == ' ')
+        {
+            continue;
+        }
+
+        if (*p == ',')
+        {
+            /* primary key must be complete before backup one */
+            if (key_len != 16 || nibble >= 0)
+            {
+                errno = EINVAL;
+                return -1;
+            }
+            continue;
+        }
+
+        if (!isxdigit((unsigned char)*p) || key_len >= sizeof(key))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        int value = isdigit((unsigned char)*p) ? *p - '0' : tolower((unsigned char)*p) - 'a' + 10;
+        if (nibble < 0)
+        {
+            nibble = value;
+            continue;
+        }
+        key[key_len++] = (uint8_t)(nibble << 4 | value);
+        nibble = -1;
+    }
+
+    if ((key_len != 16 && key_len != 32) || nibble >= 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return setsockopt(fd, SOL_TCP, TCP_FASTOPEN_KEY, key, key_len);
+}
+
+static int set_socket_filter(int fd, const char *path)
+{
+    /* tcpdump -ddd: instruction count, then "code jt jf k" per line */
+    FILE *file = fopen(path, "re");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    unsigned int count = 0;
+    struct sock_filter *code = NULL;
+    if (fscanf(file, "%u", &count) != 1 || count == 0 || count > BPF_MAXINSNS
+        || (code = calloc(count, sizeof(*code))) == NULL)
+    {
+        fclose(file);
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        unsigned int op = 0;
+        unsigned int jt = 0;
+        unsigned int jf = 0;
+        unsigned int k = 0;
+        if (fscanf(file, "%u %u %u %u", &op, &jt, &jf, &k) != 4 || op > UINT16_MAX || jt > UINT8_MAX || jf > UINT8_MAX)
+        {
+            fclose(file);
+            free(code);
+            errno = EINVAL;
+            return -1;
+        }
+        code[i] = (struct sock_filter){.code = (uint16_t)op, .jt = (uint8_t)jt, .jf = (uint8_t)jf, .k = k};
+    }
+    fclose(file);
+
+    /* kernel verifies program, bad one fails here */
+    struct sock_fprog prog = {.len = (unsigned short)count, .filter = code};
+    int ret = setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+    free(code);
+    return ret;
+}
+
+static int set_socket_filter_bpf(int fd, const char *pinned)
+{
+    union bpf_attr attr = {0};
+    attr.pathname = (uint64_t)(uintptr_t)pinned;
+    attr.file_flags = BPF_F_RDONLY;
+    int prog_fd = sys_bpf(BPF_OBJ_GET, &attr, sizeof(attr));
+    if (prog_fd < 0)
+    {
+        return -1;
+    }
+
+    /* socket holds its own reference */
+    int ret = setsockopt(fd, SOL_SOCKET, SO_ATTACH_BPF, &prog_fd, sizeof(prog_fd));
+    close(prog_fd);
+    return ret;
+}
+
+static int64_t monotonic_ms(void)
+{
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int reuseport_migrate_setup(struct listen_on *base, int steered)
+{
+    /* CPU steering cBPF owns the group, it can not migrate */
+    if (!steered)
+    {
+        reuseport_migrate_prog = reuseport_migrate_prog_load();
+        if (reuseport_migrate_prog >= 0)
+        {
+            /* same as io_uring ring: do not take 3 and shift every socket */
+            const int high = fcntl(reuseport_migrate_prog, F_DUPFD_CLOEXEC, 3 + listen_on_size(base));
+            if (high >= 0)
+            {
+                close(reuseport_migrate_prog);
+                reuseport_migrate_prog = high;
+            }
+            return 0;
+        }
+        perror("BPF_PROG_LOAD sk_reuseport");
+    }
+
+    /* whole network namespace, every group without own program */
+    int fd = open("/proc/sys/net/ipv4/tcp_migrate_req", O_WRONLY | O_CLOEXEC);
+    if (fd < 0 || write(fd, "1", 1) != 1)
+    {
+        perror("net.ipv4.tcp_migrate_req");
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return 1;
+    }
+    close(fd);
+    fprintf(stderr, "ReusePortMigrate: net.ipv4.tcp_migrate_req enabled\n");
+    return 0;
+}
+
+static int reuseport_migrate_prog_load(void)
+{
+    /*
+        SK_PASS without bpf_sk_select_reuseport(): kernel picks socket by
+        hash as usual, and when migrating, one of remaining listeners.
+    */
+    const struct bpf_insn insns[] = {
+        {.code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_0, .imm = SK_PASS},
+        {.code = BPF_JMP | BPF_EXIT},
+    };
+
+    union bpf_attr attr = {0};
+    attr.prog_type = BPF_PROG_TYPE_SK_REUSEPORT;
+    attr.expected_attach_type = BPF_SK_REUSEPORT_SELECT_OR_MIGRATE;
+    attr.insns = (uintptr_t)insns;
+    attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+    attr.license = (uintptr_t) "GPL";
+    return sys_bpf(BPF_PROG_LOAD, &attr, sizeof(attr));
+}
+
+static int set_reuseport_cpu_steering(int fd, uint32_t group_size)
+{
+    /*
+        Return index of socket in SO_REUSEPORT group: cpu % group_size.
+        Sockets are indexed in order they were bound. Attaching before
+        bind is fine, kernel allocates group for us.
+    */
+    struct sock_filter code[] = {
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU},
+        {BPF_ALU | BPF_MOD | BPF_K, 0, 0, group_size},
+        {BPF_RET | BPF_A, 0, 0, 0},
+    };
+    struct sock_fprog prog = {
+        .len = sizeof(code) / sizeof(code[0]),
+        .filter = code,
+    };
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+}
+
+static int lock_unix_socket(struct listen_on *lo)
+{
+    const struct sockaddr_un *unix_addr = (const struct sockaddr_un *)&lo->addr;
+    if (unix_addr->sun_path[0] == '\0')
+    {
+        return 0;
+    }
+
+    // if name is not abstract check lock
+    char path[PATH_MAX];
+
+    /* copy is needed, dirname will destroy content of passed string */
+    char sun_cpy1[sizeof(unix_addr->sun_path)];
+    char sun_cpy2[sizeof(unix_addr->sun_path)];
+
+    memcpy(sun_cpy1, unix_addr->sun_path, sizeof(sun_cpy1)); /* NOLINT */
+    memcpy(sun_cpy2, unix_addr->sun_path, sizeof(sun_cpy1)); /* NOLINT */
+
+    char *dir_name = dirname(sun_cpy1);
+    char *file_name = basename(sun_cpy2);
+
+    /* NOLINTNEXTLINE */
+    snprintf(path, sizeof(path) - 1, "%s/~%s", dir_name, file_name);
+
+    /*
+        this is 'hackinsh' as now we have leaking descriptor to app,
+        that is not aware of leaked descriptor, and listening sockets
+        might be spread all around.
+    */
+    int flock_fd = open(path, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+
+    /* there is now simple way for using flock:
+        - passing 'flock' fd to child (after expected FDs)
+        - faking flock like 'pid' file
+    */
+    if (flock_fd < 0)
+    {
+        perror("open");
+        fprintf(stderr, "Unable to create lock file: %s\n", path);
+        return 1;
+    }
+
+    if (flock(flock_fd, LOCK_EX | LOCK_NB))
+    {
+        perror("flock");
+        fprintf(stderr, "Someone else is using socket: %s\n", unix_addr->sun_path);
+        return 1;
+    }
+
+    /* opened between sockets, listen_on_arrange_fds moves it after them */
+    lo->locked = true;
+    lo->lock_fd = flock_fd;
+
+    int ret = unlink(unix_addr->sun_path);
+    if (ret != 0 && errno != ENOENT)
+    {
+        perror("unlink");
+        fprintf(stderr, "Unable to unlink socket file: %s\n", unix_addr->sun_path);
+        return 1;
+    }
+    return 0;
+}
+
+/* xdp impl */
+
+static int sys_bpf(int cmd, union bpf_attr *attr, unsigned int size)
+{
+    return (int)syscall(SYS_bpf, cmd, attr, size);
+}
+
+static int xdp_umem_create(size_t size, void **area)
+{
+    /* hugepages first, fewer TLB misses for app touching every frame */
+    int fd = memfd_create("listen-like-umem", MFD_CLOEXEC | MFD_HUGETLB);
+    if (fd >= 0 && ftruncate(fd, (off_t)size) == 0)
+    {
+        *area = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+        if (*area != MAP_FAILED)
+        {
+            return fd;
+        }
+    }
+
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    fprintf(stderr, "No hugepages for UMEM, using regular pages\n");
+
+    fd = memfd_create("listen-like-umem", MFD_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (ftruncate(fd, (off_t)size))
+    {
+        close(fd);
+        return -1;
+    }
+
+    *area = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (*area == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int xdp_prog_load(int xsk_map_fd, uint16_t port)
+{
+#define INSN(c, d, s, o, i) ((struct bpf_insn){.code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i)})
+    /*
+        if eth/ipv4/udp and dport == port:
+            return bpf_redirect_map(xsks, rx_queue_index, XDP_PASS)
+        return XDP_PASS
+    */
+    struct bpf_insn insns[] = {
+        /* r6 = ctx, r2 = data, r3 = data_end */
+        INSN(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0),
+        INSN(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, data), 0),
+        INSN(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end), 0),
+        /* ethernet + minimal ipv4 header */
+        INSN(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0),
+        INSN(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, 14 + 20),
+        INSN(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 19, 0),
+        /* h_proto == ETH_P_IP */
+        INSN(BPF_LDX | BPF_H | BPF_MEM, BPF_REG_5, BPF_REG_2, 12, 0),
+        INSN(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 17, htons(0x0800)),
+        /* protocol == IPPROTO_UDP */
+        INSN(BPF_LDX | BPF_B | BPF_MEM, BPF_REG_5, BPF_REG_2, 14 + 9, 0),
+        INSN(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 15, IPPROTO_UDP),
+        /* skip ipv4 header with options: r2 += ihl * 4 */
+        INSN(BPF_LDX | BPF_B | BPF_MEM, BPF_REG_5, BPF_REG_2, 14, 0),
+        INSN(BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_5, 0, 0, 0x0f),
+        INSN(BPF_ALU64 | BPF_LSH | BPF_K, BPF_REG_5, 0, 0, 2),
+        INSN(BPF_ALU64 | BPF_ADD | BPF_X, BPF_REG_2, BPF_REG_5, 0, 0),
+        INSN(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0),
+        INSN(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, 14 + 8),
+        INSN(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 8, 0),
+        /* udp dest == port */
+        INSN(BPF_LDX | BPF_H | BPF_MEM, BPF_REG_5, BPF_REG_2, 14 + 2, 0),
+        INSN(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 6, htons(port)),
+        /* bpf_redirect_map(map, rx_queue_index, XDP_PASS) */
+        INSN(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, rx_queue_index), 0),
+        INSN(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, xsk_map_fd),
+        INSN(0, 0, 0, 0, 0),
+        INSN(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS),
+        INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+        INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        /* pass: */
+        INSN(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS),
+        INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+    };
+#undef INSN
+
+    char log[4096] = {0};
+    union bpf_attr attr = {0};
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uintptr_t)insns;
+    attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+    attr.license = (uintptr_t) "GPL";
+    attr.log_buf = (uintptr_t)log;
+    attr.log_size = sizeof(log);
+    attr.log_level = 1;
+
+    int fd = sys_bpf(BPF_PROG_LOAD, &attr, sizeof(attr));
+    if (fd < 0 && log[0])
+    {
+        fprintf(stderr, "%s\n", log);
+    }
+    return fd;
+}
+
+static int listen_on_setup_xdp(struct listen_on *lo, const struct arguments *args)
+{
+    struct sockaddr_xdp *sxdp = (struct sockaddr_xdp *)&lo->addr;
+    const size_t umem_size = (size_t)args->xdp_frame_count * args->xdp_frame_size;
+
+    void *area = NULL;
+    int umem_fd = xdp_umem_create(umem_size, &area);
+    if (umem_fd < 0)
+    {
+        perror("UMEM memfd");
+        return 1;
+    }
+
+    struct xdp_umem_reg reg = {
+        .addr = (uintptr_t)area,
+        .len = umem_size,
+        .chunk_size = args->xdp_frame_size,
+    };
+    if (setsockopt(lo->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)))
+    {
+        perror("XDP_UMEM_REG");
+        return 1;
+    }
+    /* pages stay pinned by UMEM, app maps memfd again */
+    munmap(area, umem_size);
+
+    const int ring_opts[] = {XDP_UMEM_FILL_RING, XDP_UMEM_COMPLETION_RING, XDP_RX_RING, XDP_TX_RING};
+    for (size_t i = 0; i < sizeof(ring_opts) / sizeof(ring_opts[0]); ++i)
+    {
+        if (setsockopt(lo->fd, SOL_XDP, ring_opts[i], &args->xdp_ring_size, sizeof(args->xdp_ring_size)))
+        {
+            perror("XDP ring size");
+            return 1;
+        }
+    }
+
+    /* copy mode for generic XDP, otherwise let kernel pick zero copy if possible */
+    sxdp->sxdp_flags = XDP_USE_NEED_WAKEUP;
+    if (args->xdp_mode == XDP_FLAGS_SKB_MODE)
+    {
+        sxdp->sxdp_flags |= XDP_COPY;
+    }
+    if (bind(lo->fd, (struct sockaddr *)sxdp, sizeof(*sxdp)))
+    {
+        perror("bind");
+        return 1;
+    }
+
+    union bpf_attr attr = {0};
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = sxdp->sxdp_queue_id + 1;
+    int map_fd = sys_bpf(BPF_MAP_CREATE, &attr, sizeof(attr));
+    if (map_fd < 0)
+    {
+        perror("BPF_MAP_CREATE");
+        return 1;
+    }
+
+    uint32_t key = sxdp->sxdp_queue_id;
+    uint32_t value = (uint32_t)lo->fd;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map_fd;
+    attr.key = (uintptr_t)&key;
+    attr.value = (uintptr_t)&value;
+    if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr, sizeof(attr)))
+    {
+        perror("BPF_MAP_UPDATE_ELEM");
+        return 1;
+    }
+
+    int prog_fd = xdp_prog_load(map_fd, lo->xdp_port);
+    if (prog_fd < 0)
+    {
+        perror("BPF_PROG_LOAD");
+        return 1;
+    }
+
+    /* link goes away with last descriptor, so XDP program lives as long as app */
+    int link_fd = -1;
+    const uint32_t modes[] = {XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE};
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]) && link_fd < 0; ++i)
+    {
+        if (args->xdp_mode && args->xdp_mode != modes[i])
+        {
+            continue;
+        }
+        memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = (uint32_t)prog_fd;
+        attr.link_create.target_ifindex = sxdp->sxdp_ifindex;
+        attr.link_create.attach_type = BPF_XDP;
+        attr.link_create.flags = modes[i];
+        link_fd = sys_bpf(BPF_LINK_CREATE, &attr, sizeof(attr));
+    }
+    if (link_fd < 0)
+    {
+        perror("BPF_LINK_CREATE");
+        return 1;
+    }
+
+    /* both referenced by link now */
+    close(prog_fd);
+    close(map_fd);
+
+    char ifname[IF_NAMESIZE] = {0};
+    if_indextoname(sxdp->sxdp_ifindex, ifname);
+
+    /* xsk, umem, xdp link in that order */
+    char *umem_name = NULL;
+    char *link_name = NULL;
+    if (asprintf(&umem_name, "umem-%s-%u", ifname, sxdp->sxdp_queue_id) < 0
+        || asprintf(&link_name, "xdp-%s-%u", ifname, sxdp->sxdp_queue_id) < 0)
+    {
+        return 1;
+    }
+    struct listen_on *umem = listen_on_add_aux(lo, umem_fd, umem_name);
+    listen_on_add_aux(umem, link_fd, link_name);
+
+    fprintf(stderr, "XDP on %s queue %u: %zu bytes UMEM, port %u redirected\n",
+        ifname, sxdp->sxdp_queue_id, umem_size, lo->xdp_port);
+    return 0;
+}
+
+/* metrics impl */
+
+static int metrics_ino_cmp(const void *a, const void *b)
+{
+    const struct metrics_ino *l = a;
+    const struct metrics_ino *r = b;
+    return l->ino < r->ino ? -1 : l->ino > r->ino;
+}
+
+static int metrics_setup(struct metrics *m, const struct arguments *args)
+{
+    m->arguments = args;
+    m->fd = -1;
+    m->next_write = args->metrics_file ? monotonic_ms() : INT64_MAX;
+
+    if (args->metrics_socket == NULL)
+    {
+        return 0;
+    }
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(args->metrics_socket) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "MetricsSocket path too long: %s\n", args->metrics_socket);
+        return 1;
+    }
+    strncpy(addr.sun_path, args->metrics_socket, sizeof(addr.sun_path) - 1);
+
+    if (arguments_create_path(addr.sun_path, args))
+    {
+        return 1;
+    }
+    /* left over by previous run, nobody else should be serving there */
+    unlink(addr.sun_path);
+
+    m->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (m->fd < 0)
+    {
+        perror("socket");
+        return 1;
+    }
+
+    if (bind(m->fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(m->fd, 16))
+    {
+        perror("MetricsSocket");
+        return 1;
+    }
+
+    fprintf(stderr, "Metrics on %s\n", args->metrics_socket);
+    return 0;
+}
+
+static int metrics_serve(struct metrics *m)
+{
+    for (;;)
+    {
+        int conn = accept4(m->fd, NULL, NULL, SOCK_CLOEXEC);
+        if (conn < 0)
+        {
+            /* EAGAIN, or whatever client did wrong, try next time */
+            return 0;
+        }
+
+        /* slow reader must not stall supervisor */
+        struct timeval timeout = {.tv_sec = 1};
+        setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        size_t size = 0;
+        char *text = metrics_render(m->arguments, &size);
+        if (text)
+        {
+            /* request is not even read, every path is the metrics path */
+            char header[128];
+            /* NOLINTNEXTLINE */
+            int header_len = snprintf(header, sizeof(header),
+                "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", size);
+            struct iovec iov[2] = {
+                {.iov_base = header, .iov_len = (size_t)header_len},
+                {.iov_base = text, .iov_len = size},
+            };
+            struct msghdr msg = {.msg_iov = iov, .msg_iovlen = 2};
+            sendmsg(conn, &msg, MSG_NOSIGNAL);
+            free(text);
+        }
+        close(conn);
+    }
+}
+
+static int metrics_write_file(struct metrics *m)
+{
+    const char *path = m->arguments->metrics_file;
+    size_t size = 0;
+    char *text = metrics_render(m->arguments, &size);
+    if (text == NULL)
+    {
+        return 1;
+    }
+
+    /* textfile collectors expect file to be replaced, never half written */
+    char tmp[PATH_MAX];
+    /* NOLINTNEXTLINE */
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    int ret = 1;
+    FILE *f = fopen(tmp, "we");
+    if (f == NULL)
+    {
+        perror(tmp);
+    }
+    else if (fwrite(text, 1, size, f) != size || fclose(f))
+    {
+        perror(tmp);
+        unlink(tmp);
+    }
+    else if (rename(tmp, path))
+    {
+        perror(path);
+    }
+    else
+    {
+        ret = 0;
+    }
+    free(text);
+    return ret;
+}
+
+static void metrics_tick(struct metrics *m)
+{
+    const int64_t now = monotonic_ms();
+    if (now < m->next_write)
+    {
+        return;
+    }
+    metrics_write_file(m);
+    m->next_write = now + m->arguments->metrics_interval_ms;
+}
+
+static int metrics_spawn_helper(struct metrics *m)
+{
+    /*
+        After exec nobody is left to serve metrics, so a helper stays
+        behind as child of the app and goes down with it (PDEATHSIG).
+    */
+    const pid_t parent = getpid();
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        return 1;
+    }
+
+    if (pid > 0)
+    {
+        if (m->fd >= 0)
+        {
+            close(m->fd);
+        }
+        return 0;
+    }
+
+    if (prctl(PR_SET_PDEATHSIG, SIGTERM) || getppid() != parent)
+    {
+        _exit(0);
+    }
+
+    /* own references would keep listeners alive after app is gone */
+    for (const struct listen_on *lo = &m->arguments->listeners; lo != NULL; lo = lo->next)
+    {
+        close(lo->fd);
+    }
+
+    for (;;)
+    {
+        int timeout = -1;
+        if (m->next_write != INT64_MAX)
+        {
+            const int64_t now = monotonic_ms();
+            timeout = m->next_write > now ? (int)(m->next_write - now) : 0;
+        }
+
+        struct pollfd pfd = {.fd = m->fd, .events = POLLIN};
+        int n = poll(&pfd, 1, timeout);
+        if (n < 0 && errno != EINTR)
+        {
+            perror("poll");
+            _exit(1);
+        }
+
+        if (n > 0)
+        {
+            metrics_serve(m);
+        }
+        metrics_tick(m);
+    }
+}
+
+static char *metrics_render(const struct arguments *args, size_t *size)
+{
+    const uint32_t count = (uint32_t)listen_on_size((struct listen_on *)&args->listeners);
+    struct metrics_sample *samples = calloc(count, sizeof(*samples));
+    struct metrics_ino *inos = calloc(count, sizeof(*inos));
+    if (samples == NULL || inos == NULL)
+    {
+        free(samples);
+        free(inos);
+        return NULL;
+    }
+
+    /* one dump per family and protocol in use */
+    int want_unix = false;
+    int want_inet[2][2] = {{false}};
+    uint32_t i = 0;
+    for (const struct listen_on *lo = &args->listeners; lo != NULL; lo = lo->next, ++i)
+    {
+        inos[i] = (struct metrics_ino){.ino = lo->ino, .index = i};
+        if (lo->kind != LISTEN_ON_SOCKET)
+        {
+            continue;
+        }
+
+        if (lo->addr.ss_family == AF_UNIX)
+        {
+            want_unix = true;
+        }
+        else if (listen_on_is_tcp(lo) || listen_on_is_udp(lo))
+        {
+            want_inet[lo->addr.ss_family == AF_INET6][listen_on_is_udp(lo)] = true;
+        }
+    }
+    qsort(inos, count, sizeof(*inos), metrics_ino_cmp);
+
+    for (int v6 = 0; v6 < 2; ++v6)
+    {
+        for (int udp = 0; udp < 2; ++udp)
+        {
+            if (want_inet[v6][udp])
+            {
+                metrics_diag(v6 ? AF_INET6 : AF_INET, udp ? IPPROTO_UDP : IPPROTO_TCP, inos, count, samples);
+            }
+        }
+    }
+    if (want_unix)
+    {
+        metrics_diag(AF_UNIX, 0, inos, count, samples);
+    }
+    free(inos);
+
+    uint64_t listen_overflows = 0;
+    uint64_t listen_drops = 0;
+    metrics_netstat(&listen_overflows, &listen_drops);
+
+    char *text = NULL;
+    FILE *out = open_memstream(&text, size);
+    if (out == NULL)
+    {
+        free(samples);
+        return NULL;
+    }
+
+    static const char *const skmem_kinds[SK_MEMINFO_VARS] = {
+        "rmem_alloc", "rcvbuf", "wmem_alloc", "sndbuf", "fwd_alloc", "wmem_queued", "optmem", "backlog", "drops",
+    };
+
+    fprintf(out, "# HELP listen_like_accept_queue Connections waiting in accept queue.\n");
+    fprintf(out, "# TYPE listen_like_accept_queue gauge\n");
+    i = 0;
+    for (const struct listen_on *lo = &args->listeners; lo != NULL; lo = lo->next, ++i)
+    {
+        if (samples[i].found && lo->socket_type != SOCK_DGRAM)
+        {
+            fprintf(out, "listen_like_accept_queue");
+            metrics_label(out, lo, NULL);
+            fprintf(out, " %u\n", samples[i].rqueue);
+        }
+    }
+
+    fprintf(out, "# HELP listen_like_accept_queue_limit Accept queue limit, Backlog capped by somaxconn.\n");
+    fprintf(out, "# TYPE listen_like_accept_queue_limit gauge\n");
+    i = 0;
+    for (const struct listen_on *lo = &args->listeners; lo != NULL; lo = lo->next, ++i)
+    {
+        if (samples[i].found && lo->socket_type != SOCK_DGRAM)
+        {
+            fprintf(out, "listen_like_accept_queue_limit");
+            metrics_label(out, lo, NULL);
+            fprintf(out, " %u\n", samples[i].wqueue);
+        }
+    }
+
+    fprintf(out, "# HELP listen_like_socket_memory_bytes Socket memory (skmem), receive queue is rmem_alloc.\n");
+    fprintf(out, "# TYPE listen_like_socket_memory_bytes gauge\n");
+    i = 0;
+    for (const struct listen_on *lo = &args->listeners; lo != NULL; lo = lo->next, ++i)
+    {
+        for (int k = 0; samples[i].found && k < SK_MEMINFO_DROPS; ++k)
+        {
+            fprintf(out, "listen_like_socket_memory_bytes");
+            metrics_label(out, lo, skmem_kinds[k]);
+            fprintf(out, " %u\n", samples[i].skmem[k]);
+        }
+    }
+
+    fprintf(out, "# HELP listen_like_drops_total Packets dropped by socket, eg. receive queue full.\n");
+    fprintf(out, "# TYPE listen_like_drops_total counter\n");
+    i = 0;
+    for (const struct listen_on *lo = &args->listeners; lo != NULL; lo = lo->next, ++i)
+    {
+        if (samples[i].found)
+        {
+            fprintf(out, "listen_like_drops_total");
+            metrics_label(out, lo, NULL);
+            fprintf(out, " %u\n", samples[i].skmem[SK_MEMINFO_DROPS]);
+        }
+    }
+
+    fprintf(out, "# HELP listen_like_tcp_listen_overflows_total TcpExt ListenOverflows of network namespace.\n");
+    fprintf(out, "# TYPE listen_like_tcp_listen_overflows_total counter\n");
+    fprintf(out, "listen_like_tcp_listen_overflows_total %llu\n", (unsigned long long)listen_overflows);
+    fprintf(out, "# HELP listen_like_tcp_listen_drops_total TcpExt ListenDrops of network namespace.\n");
+    fprintf(out, "# TYPE listen_like_tcp_listen_drops_total counter\n");
+    fprintf(out, "listen_like_tcp_listen_drops_total %llu\n", (unsigned long long)listen_drops);
+
+    free(samples);
+    if (fclose(out))
+    {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+static void metrics_label(FILE *out, const struct listen_on *lo, const char *kind)
+{
+    fputs("{listen=\"", out);
+    for (const char *c = lo->socket_listen; c && *c; ++c)
+    {
+        if (*c == '\\' || *c == '"')
+        {
+            fputc('\\', out);
+        }
+        fputc(*c == '\n' ? ' ' : *c, out);
+    }
+    fprintf(out, "\",fd=\"%d\",type=\"%s\"", lo->fd, listen_on_type(lo));
+    if (kind)
+    {
+        fprintf(out, ",kind=\"%s\"", kind);
+    }
+    fputc('}', out);
+}
+
+static int metrics_diag(int family, int protocol, const struct metrics_ino *inos, size_t inos_size, struct metrics_sample *samples)
+{
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+    if (fd < 0)
+    {
+        perror("NETLINK_SOCK_DIAG");
+        return 1;
+    }
+
+    struct
+    {
+        struct nlmsghdr nlh;
+        union
+        {
+            struct inet_diag_req_v2 inet;
+            struct unix_diag_req un;
+        };
+    } req = {0};
+    req.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+
+    if (family == AF_UNIX)
+    {
+        req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.un));
+        req.un.sdiag_family = AF_UNIX;
+        req.un.udiag_states = ~0u;
+        req.un.udiag_show = UDIAG_SHOW_RQLEN | UDIAG_SHOW_MEMINFO;
+    }
+    else
+    {
+        req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.inet));
+        req.inet.sdiag_family = family;
+        req.inet.sdiag_protocol = protocol;
+        req.inet.idiag_ext = 1 << (INET_DIAG_SKMEMINFO - 1);
+        /* UDP sockets are TCP_CLOSE, or TCP_ESTABLISHED when connected */
+        req.inet.idiag_states = protocol == IPPROTO_TCP ? 1 << TCP_LISTEN : ~0u;
+    }
+
+    if (send(fd, &req, req.nlh.nlmsg_len, 0) < 0)
+    {
+        perror("sock_diag");
+        close(fd);
+        return 1;
+    }
+
+    int ret = 1;
+    long buf[8192];
+    for (;;)
+    {
+        ssize_t len = recv(fd, buf, sizeof(buf), 0);
+        if (len <= 0)
+        {
+            break;
+        }
+
+        for (struct nlmsghdr *nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, (size_t)len); nlh = NLMSG_NEXT(nlh, len))
+        {
+            if (nlh->nlmsg_type == NLMSG_DONE)
+            {
+                ret = 0;
+                goto done;
+            }
+            if (nlh->nlmsg_type == NLMSG_ERROR)
+            {
+                goto done;
+            }
+
+            struct metrics_ino key = {0};
+            const struct inet_diag_msg *inet_msg = NULL;
+            struct rtattr *attr = NULL;
+            int attr_len = 0;
+            if (family == AF_UNIX)
+            {
+                const struct unix_diag_msg *msg = NLMSG_DATA(nlh);
+                key.ino = msg->udiag_ino;
+                attr = (struct rtattr *)(msg + 1);
+                attr_len = (int)(nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*msg)));
+            }
+            else
+            {
+                inet_msg = NLMSG_DATA(nlh);
+                key.ino = inet_msg->idiag_inode;
+                attr = (struct rtattr *)(inet_msg + 1);
+                attr_len = (int)(nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*inet_msg)));
+            }
+
+            const struct metrics_ino *found = bsearch(&key, inos, inos_size, sizeof(*inos), metrics_ino_cmp);
+            if (found == NULL)
+            {
+                continue;
+            }
+
+            struct metrics_sample *sample = &samples[found->index];
+            sample->found = true;
+            if (inet_msg)
+            {
+                /* listening: accept queue length and backlog */
+                sample->rqueue = inet_msg->idiag_rqueue;
+                sample->wqueue = inet_msg->idiag_wqueue;
+            }
+            for (; RTA_OK(attr, attr_len); attr = RTA_NEXT(attr, attr_len))
+            {
+                const size_t payload = RTA_PAYLOAD(attr);
+                if ((family == AF_UNIX && attr->rta_type == UNIX_DIAG_MEMINFO)
+                    || (family != AF_UNIX && attr->rta_type == INET_DIAG_SKMEMINFO))
+                {
+                    memcpy(sample->skmem, RTA_DATA(attr), payload < sizeof(sample->skmem) ? payload : sizeof(sample->skmem));
+                }
+                else if (family == AF_UNIX && attr->rta_type == UNIX_DIAG_RQLEN && payload >= sizeof(struct unix_diag_rqlen))
+                {
+                    const struct unix_diag_rqlen *rqlen = RTA_DATA(attr);
+                    sample->rqueue = rqlen->udiag_rqueue;
+                    sample->wqueue = rqlen->udiag_wqueue;
+                }
+            }
+        }
+    }
+
+done:
+    close(fd);
+    return ret;
+}
+
+static void metrics_netstat(uint64_t *listen_overflows, uint64_t *listen_drops)
+{
+    /* pairs of lines: "TcpExt: Name1 Name2 ...", "TcpExt: 1 2 ..." */
+    FILE *f = fopen("/proc/net/netstat", "re");
+    if (f == NULL)
+    {
+        return;
+    }
+
+    char *names = NULL;
+    size_t names_size = 0;
+    char *values = NULL;
+    size_t values_size = 0;
+    while (getline(&names, &names_size, f) > 0 && getline(&values, &values_size, f) > 0)
+    {
+        if (strncmp(names, "TcpExt:", 7) != 0)
+        {
+            continue;
+        }
+
+        char *names_save = NULL;
+        char *values_save = NULL;
+        char *name = strtok_r(names, " \n", &names_save);
+        char *value = strtok_r(values, " \n", &values_save);
+        while (name && value)
+        {
+            if (strcmp(name, "ListenOverflows") == 0)
+            {
+                *listen_overflows = strtoull(value, NULL, 10);
+            }
+            else if (strcmp(name, "ListenDrops") == 0)
+            {
+                *listen_drops = strtoull(value, NULL, 10);
+            }
+            name = strtok_r(NULL, " \n", &names_save);
+            value = strtok_r(NULL, " \n", &values_save);
+        }
         break;
-    case ARG_SEND_BUFFER:
-        return parse_uint32(arg, &lo->send_buffer);
-    case ARG_RECEIVE_BUFFER:
-        return parse_uint32(arg, &lo->recv_buffer);
-    case ARG_IP_TOS:
-        // IPTOS_LOWDELAY and company
-        fprintf(stderr, "WARNING: ToS has been deprecated. Use DSCP\n");
-        return parse_uint32(arg, &lo->tos);
-    case ARG_IP_TTL:
-        return parse_uint32(arg, &lo->ttl);
-    case ARG_PRIORITY:
-        return parse_uint32(arg, &lo->priority);
-    case ARG_IP_DSCP:
-        return parse_uint32(arg, &lo->dscp);
-    case ARG_SOCKET_PROTOCOL:
-        fprintf(stderr, "WARNING: Using SocketProtocol might result in hard to debug errors\n");
-        return parse_uint32(arg, &lo->socket_protocol);
+    }
+
+    free(names);
+    free(values);
+    fclose(f);
+}
+
+/* handoff impl */
+
+static int handoff_listen(const struct arguments *args)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(args->handoff_socket) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "HandoffSocket path too long: %s\n", args->handoff_socket);
+        return -1;
+    }
+    strncpy(addr.sun_path, args->handoff_socket, sizeof(addr.sun_path) - 1);
+
+    if (arguments_create_path(addr.sun_path, args))
+    {
+        return -1;
+    }
+    /* previous instance served there, listeners are ours now */
+    unlink(addr.sun_path);
+
+    /* message per listener, no framing needed */
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || chmod(addr.sun_path, S_IRUSR | S_IWUSR) || listen(fd, 4))
+    {
+        perror("HandoffSocket");
+        close(fd);
+        return -1;
+    }
+
+    fprintf(stderr, "Handing listeners over on %s\n", args->handoff_socket);
+    return fd;
+}
+
+static int handoff_serve(const struct arguments *args, int server_fd)
+{
+    for (;;)
+    {
+        int conn = accept4(server_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (conn < 0)
+        {
+            return 0;
+        }
+
+        /* listeners are as good as root shell of app, mode 0600 is not enough alone */
+        struct ucred cred;
+        socklen_t cred_len = sizeof(cred);
+        if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) || (cred.uid != geteuid() && cred.uid != 0))
+        {
+            fprintf(stderr, "Handoff refused to uid %u\n", cred.uid);
+            close(conn);
+            continue;
+        }
+
+        /* stuck peer must not stall supervisor */
+        struct timeval timeout = {.tv_sec = 1};
+        setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        uint32_t sent = 0;
+        for (const struct listen_on *lo = &args->listeners; lo != NULL; lo = lo->next)
+        {
+            if (lo->kind != LISTEN_ON_SOCKET)
+            {
+                continue;
+            }
+            if (handoff_send(conn, lo))
+            {
+                perror("handoff sendmsg");
+                break;
+            }
+            ++sent;
+        }
+
+        /* EOF tells there is nothing more */
+        close(conn);
+        fprintf(stderr, "Handed %u listener(s) over to pid=%d\n", sent, cred.pid);
+    }
+}
+
+static int handoff_send(int conn, const struct listen_on *lo)
+{
+    /* payload: socket_listen with '\0', descriptor in SCM_RIGHTS */
+    struct iovec iov = {.iov_base = (void *)lo->socket_listen, .iov_len = strlen(lo->socket_listen) + 1};
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &lo->fd, sizeof(int));
+
+    return sendmsg(conn, &msg, MSG_NOSIGNAL) < 0;
+}
+
+static int handoff_inherit(struct listen_on *base, const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    int conn = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (conn < 0)
+    {
+        perror("socket");
+        return 1;
+    }
+
+    /* first start of the kind, nobody to inherit from */
+    if (connect(conn, (struct sockaddr *)&addr, sizeof(addr)))
+    {
+        fprintf(stderr, "Nothing to inherit from %s: %s\n", path, strerror(errno));
+        close(conn);
+        return 0;
+    }
+
+    uint32_t adopted = 0;
+    uint32_t dropped = 0;
+    for (;;)
+    {
+        char name[PATH_MAX] = {0};
+        struct iovec iov = {.iov_base = name, .iov_len = sizeof(name) - 1};
+        union
+        {
+            char buf[CMSG_SPACE(sizeof(int))];
+            struct cmsghdr align;
+        } control;
+        struct msghdr msg = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control.buf,
+            .msg_controllen = sizeof(control.buf),
+        };
+
+        /* no MSG_CMSG_CLOEXEC, adopted listeners are passed to app */
+        ssize_t n = recvmsg(conn, &msg, 0);
+        if (n <= 0)
+        {
+            break;
+        }
+
+        int fd = -1;
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+        }
+        if (fd < 0)
+        {
+            continue;
+        }
+
+        /* port range and ReusePortGroup share name, first free one in order */
+        struct listen_on *match = NULL;
+        for (struct listen_on *lo = base; lo != NULL && match == NULL; lo = lo->next)
+        {
+            if (lo->kind == LISTEN_ON_SOCKET && !lo->set_up && lo->fd < 0
+                && strcmp(lo->socket_listen, name) == 0 && handoff_match(lo, fd))
+            {
+                match = lo;
+            }
+        }
+
+        if (match == NULL)
+        {
+            fprintf(stderr, "Inherited listener not configured any more, closing: %s\n", name);
+            close(fd);
+            ++dropped;
+            continue;
+        }
+
+        match->fd = fd;
+        match->set_up = true;
+        ++adopted;
+    }
+    close(conn);
+
+    fprintf(stderr, "Inherited %u listener(s) from %s, %u dropped\n", adopted, path, dropped);
+    return 0;
+}
+
+static int handoff_match(const struct listen_on *lo, int fd)
+{
+    int domain = 0;
+    int type = 0;
+    int protocol = 0;
+    socklen_t len = sizeof(int);
+    if (getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &len)
+        || getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len)
+        || getsockopt(fd, SOL_SOCKET, SO_PROTOCOL, &protocol, &len))
+    {
+        return false;
+    }
+
+    if (domain != lo->addr.ss_family || type != lo->socket_type)
+    {
+        return false;
+    }
+
+    /* 0 - whatever kernel picked for family and type */
+    if (lo->socket_protocol && (uint32_t)protocol != lo->socket_protocol)
+    {
+        return false;
+    }
+
+    /* same name, but port of range must match too */
+    if (domain == AF_INET || domain == AF_INET6)
+    {
+        struct sockaddr_storage bound;
+        socklen_t bound_len = sizeof(bound);
+        const uint16_t port = listen_on_port(lo);
+        if (getsockname(fd, (struct sockaddr *)&bound, &bound_len))
+        {
+            return false;
+        }
+        const uint16_t bound_port = domain == AF_INET6
+            ? ntohs(((struct sockaddr_in6 *)&bound)->sin6_port)
+            : ntohs(((struct sockaddr_in *)&bound)->sin_port);
+        return port == 0 || port == bound_port;
+    }
+    return true;
+}
+
+/* uring impl */
+
+static int listen_on_setup_uring(struct listen_on *base, int backlog)
+{
+    /*
+        Socket, options, bind and listen of every plain inet listener are
+        submitted in batches, so thousands of listeners are a few dozen
+        syscalls. Whatever is not set up here (unix sockets, options with
+        fallbacks, old kernel) is left to regular syscalls.
+    */
+    struct uring_setup *us = calloc(1, sizeof(*us));
+    if (us == NULL || uring_init(&us->ring, URING_SETUP_ENTRIES))
+    {
+        free(us);
+        return ENOSYS;
+    }
+
+    if (!uring_setup_supported(&us->ring))
+    {
+        uring_free(&us->ring);
+        free(us);
+        return ENOSYS;
+    }
+
+    /*
+        Ring would take first free descriptor and shift every socket by one,
+        listen_on_arrange_fds then has to move all of them. Mappings stay
+        valid, they belong to the ring, not to descriptor number.
+    */
+    const int high = fcntl(us->ring.fd, F_DUPFD_CLOEXEC, 3 + listen_on_size(base));
+    if (high >= 0)
+    {
+        close(us->ring.fd);
+        us->ring.fd = high;
+    }
+
+    /* sockets first, descriptors are handed out in submission order */
+    for (struct listen_on *lo = base; lo != NULL; lo = lo->next)
+    {
+        if (lo->kind != LISTEN_ON_SOCKET
+            || lo->set_up
+            || (lo->addr.ss_family != AF_INET && lo->addr.ss_family != AF_INET6)
+            || !listen_on_sockopts_only(lo))
+        {
+            continue;
+        }
+
+        struct io_uring_sqe *sqe = uring_setup_sqe(us, lo, IORING_OP_SOCKET, "socket");
+        sqe->fd = lo->addr.ss_family;
+        sqe->off = lo->socket_type;
+        sqe->len = lo->socket_protocol;
+    }
+    uring_setup_flush(us);
+
+    for (struct listen_on *lo = base; lo != NULL && !us->failed; lo = lo->next)
+    {
+        if (lo->kind != LISTEN_ON_SOCKET || lo->fd < 0 || lo->set_up)
+        {
+            continue;
+        }
+
+        struct sockopt opts[LISTEN_ON_SOCKOPTS_MAX];
+        const int count = listen_on_sockopts(lo, opts);
+        if (count && us->no_sockopts)
+        {
+            continue;
+        }
+
+        /* whole chain has to go in one submit */
+        if (us->queued + count + 2 > URING_SETUP_ENTRIES)
+        {
+            uring_setup_flush(us);
+        }
+
+        /* set_up is cleared again on any failure in chain */
+        lo->set_up = true;
+
+        struct io_uring_sqe *sqe = NULL;
+        for (int i = 0; i < count; ++i)
+        {
+            sqe = uring_setup_sqe(us, lo, IORING_OP_URING_CMD, opts[i].what);
+            struct uring_setup_op *op = &us->ops[sqe->user_data];
+            op->value = opts[i].value;
+
+            /* level, optname and optlen share space with addr and file_index */
+            const uint32_t level_name[2] = {(uint32_t)opts[i].level, (uint32_t)opts[i].name};
+            sqe->fd = lo->fd;
+            sqe->cmd_op = SOCKET_URING_OP_SETSOCKOPT;
+            memcpy(&sqe->addr, level_name, sizeof(level_name));
+            sqe->file_index = sizeof(op->value);
+            sqe->addr3 = (uintptr_t)&op->value;
+            sqe->flags |= IOSQE_IO_LINK;
+        }
+
+        sqe = uring_setup_sqe(us, lo, IORING_OP_BIND, "bind");
+        sqe->fd = lo->fd;
+        sqe->addr = (uintptr_t)&lo->addr;
+        sqe->addr2 = lo->addr_len;
+
+        /* listen is not working on: UDP, nor any other datagram socket */
+        if (lo->socket_type != SOCK_DGRAM)
+        {
+            sqe->flags |= IOSQE_IO_LINK;
+            sqe = uring_setup_sqe(us, lo, IORING_OP_LISTEN, "listen");
+            sqe->fd = lo->fd;
+            sqe->len = backlog;
+        }
+    }
+    uring_setup_flush(us);
+
+    const int failed = us->failed;
+    uring_free(&us->ring);
+    free(us);
+    return failed ? EIO : 0;
+}
+
+static int uring_setup_supported(struct uring *r)
+{
+    const unsigned ops_len = 256;
+    struct io_uring_probe *probe = calloc(1, sizeof(*probe) + ops_len * sizeof(probe->ops[0]));
+    if (probe == NULL)
+    {
+        return false;
+    }
+
+    int supported = false;
+    if (syscall(SYS_io_uring_register, r->fd, IORING_REGISTER_PROBE, probe, ops_len) == 0)
+    {
+        const unsigned needed[] = {IORING_OP_SOCKET, IORING_OP_URING_CMD, IORING_OP_BIND, IORING_OP_LISTEN};
+        supported = true;
+        for (size_t i = 0; i < sizeof(needed) / sizeof(needed[0]); ++i)
+        {
+            if (needed[i] > probe->last_op || !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED))
+            {
+                supported = false;
+            }
+        }
+    }
+    free(probe);
+    return supported;
+}
+
+static struct io_uring_sqe *uring_setup_sqe(struct uring_setup *us, struct listen_on *lo, uint8_t opcode, const char *what)
+{
+    if (us->queued == URING_SETUP_ENTRIES)
+    {
+        uring_setup_flush(us);
+    }
+
+    struct io_uring_sqe *sqe = uring_get_sqe(&us->ring);
+    us->ops[us->queued] = (struct uring_setup_op){.lo = lo, .opcode = opcode, .what = what};
+    sqe->opcode = opcode;
+    sqe->user_data = us->queued++;
+    return sqe;
+}
+
+static void uring_setup_flush(struct uring_setup *us)
+{
+    const unsigned queued = us->queued;
+    us->queued = 0;
+    if (queued == 0)
+    {
+        return;
+    }
+
+    /* ring is sized for the batch, so everything is submitted at once */
+    int ret = uring_submit(&us->ring, queued);
+    if (ret < 0)
+    {
+        errno = -ret;
+        perror("io_uring_enter");
+        us->failed = true;
+        return;
+    }
+
+    for (unsigned seen = 0; seen < queued;)
+    {
+        struct io_uring_cqe *cqe = uring_peek_cqe(&us->ring);
+        if (cqe == NULL)
+        {
+            if (uring_submit(&us->ring, 1) < 0)
+            {
+                us->failed = true;
+                return;
+            }
+            continue;
+        }
+
+        struct uring_setup_op *op = &us->ops[cqe->user_data];
+        const int res = cqe->res;
+        uring_cqe_seen(&us->ring);
+        ++seen;
+
+        if (op->opcode == IORING_OP_SOCKET)
+        {
+            if (res < 0)
+            {
+                fprintf(stderr, "socket %s (port %u): %s\n", op->lo->socket_listen, listen_on_port(op->lo), strerror(-res));
+                us->failed = true;
+                continue;
+            }
+            op->lo->fd = res;
+            continue;
+        }
+
+        if (res >= 0)
+        {
+            continue;
+        }
+
+        /* rest of chain, cause is reported with its own completion */
+        op->lo->set_up = false;
+        if (res == -ECANCELED)
+        {
+            continue;
+        }
+
+        /* no setsockopt for sockets: 6.7+, regular syscalls will do */
+        if (res == -EOPNOTSUPP && op->opcode == IORING_OP_URING_CMD)
+        {
+            us->no_sockopts = true;
+            continue;
+        }
+
+        fprintf(stderr, "%s %s (port %u): %s\n", op->what, op->lo->socket_listen, listen_on_port(op->lo), strerror(-res));
+        us->failed = true;
+    }
+}
+
+
+static int uring_init(struct uring *r, unsigned entries)
+{
+    struct io_uring_params params = {0};
+    memset(r, 0, sizeof(*r));
+
+    /* io_uring fd is always O_CLOEXEC */
+    r->fd = (int)syscall(SYS_io_uring_setup, entries, &params);
+    if (r->fd < 0)
+    {
+        r->fd = -1;
+        return errno;
+    }
+
+    r->sq_entries = params.sq_entries;
+    r->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (r->cq_ring_size > r->sq_ring_size)
+        {
+            r->sq_ring_size = r->cq_ring_size;
+        }
+        r->cq_ring_size = 0;
+    }
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED)
+    {
+        goto err;
+    }
+
+    r->cq_ring = r->sq_ring;
+    if (r->cq_ring_size)
+    {
+        r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED)
+        {
+            goto err;
+        }
+    }
+
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+    {
+        goto err;
+    }
+
+    char *sq = r->sq_ring;
+    char *cq = r->cq_ring;
+    r->sq_head = (unsigned *)(sq + params.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + params.sq_off.array);
+    r->cq_head = (unsigned *)(cq + params.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    r->sqe_tail = *r->sq_tail;
+    return 0;
+
+err:;
+    int err = errno;
+    uring_free(r);
+    return err;
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct uring *r)
+{
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sqe_tail - head >= r->sq_entries)
+    {
+        return NULL;
+    }
+
+    unsigned index = r->sqe_tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[index] = index;
+    ++r->sqe_tail;
+    ++r->to_submit;
+    return sqe;
+}
+
+static int uring_submit(struct uring *r, unsigned wait_nr)
+{
+    __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    int ret = (int)syscall(SYS_io_uring_enter, r->fd, r->to_submit, wait_nr, flags, NULL, 0);
+    if (ret < 0)
+    {
+        return -errno;
+    }
+    r->to_submit -= ret;
+    return ret;
+}
+
+static struct io_uring_cqe *uring_peek_cqe(struct uring *r)
+{
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+    return &r->cqes[head & *r->cq_mask];
+}
+
+static void uring_cqe_seen(struct uring *r)
+{
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+static void uring_free(struct uring *r)
+{
+    if (r->sqes && r->sqes != MAP_FAILED)
+    {
+        munmap(r->sqes, r->sqes_size);
+    }
+    if (r->cq_ring_size && r->cq_ring && r->cq_ring != MAP_FAILED)
+    {
+        munmap(r->cq_ring, r->cq_ring_size);
+    }
+    if (r->sq_ring && r->sq_ring != MAP_FAILED)
+    {
+        munmap(r->sq_ring, r->sq_ring_size);
+    }
+    if (r->fd >= 0)
+    {
+        close(r->fd);
+    }
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+/* supervisor impl */
+
+static int supervisor_run(const struct arguments *args, char *const app_argv[])
+{
+    struct supervisor sv = {
+        .arguments = args,
+        .app_argv = app_argv,
+        .child = {.pid = 0, .pidfd = -1},
+        .pending = {.pid = 0, .pidfd = -1},
+        .notify_fd = -1,
+        .ring = {.fd = -1},
+        .metrics = {.fd = -1, .next_write = INT64_MAX},
+        .handoff_fd = -1,
+    };
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGHUP);
+    if (sigprocmask(SIG_BLOCK, &mask, &sv.old_mask))
+    {
+        perror("sigprocmask");
+        return 1;
+    }
+
+    sv.signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+    if (sv.signal_fd < 0)
+    {
+        perror("signalfd");
+        return 1;
+    }
+
+    sv.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (sv.epoll_fd < 0)
+    {
+        perror("epoll_create1");
+        return 1;
+    }
+
+    if (supervisor_watch(&sv, sv.signal_fd, EPOLLIN, WATCH_SIGNAL, sv.signal_fd))
+    {
+        return 1;
+    }
+
+    if (args->accept)
+    {
+        if (supervisor_accept_setup(&sv))
+        {
+            return 1;
+        }
+    }
+    else if (supervisor_notify_setup(&sv))
+    {
+        return 1;
+    }
+
+    if (metrics_setup(&sv.metrics, args))
+    {
+        return 1;
+    }
+
+    if (sv.metrics.fd >= 0 && supervisor_watch(&sv, sv.metrics.fd, EPOLLIN, WATCH_METRICS, sv.metrics.fd))
+    {
+        return 1;
+    }
+
+    if (args->handoff_socket)
+    {
+        sv.handoff_fd = handoff_listen(args);
+        if (sv.handoff_fd < 0 || supervisor_watch(&sv, sv.handoff_fd, EPOLLIN, WATCH_HANDOFF, sv.handoff_fd))
+        {
+            return 1;
+        }
+    }
+
+    /* Accept=yes: handlers are already waiting */
+    if (args->on_demand)
+    {
+        for (const struct listen_on *lo = &args->listeners; lo != NULL; lo = lo->next)
+        {
+            if (listen_on_pollable(lo) && supervisor_watch(&sv, lo->fd, EPOLLIN, WATCH_LISTENER, lo->fd))
+            {
+                return 1;
+            }
+        }
+        fprintf(stderr, "Waiting for activity on %d listener(s)\n", listen_on_size((struct listen_on *)&args->listeners));
+    }
+    else if (args->workers)
+    {
+        if (supervisor_workers_setup(&sv))
+        {
+            return 1;
+        }
+        for (uint32_t i = 0; i < sv.workers_size; ++i)
+        {
+            if (supervisor_spawn_worker(&sv, i))
+            {
+                /* ones started already would serve listeners nobody watches */
+                supervisor_stop(&sv, SIGTERM);
+                return 1;
+            }
+        }
+    }
+    else if (!args->accept && supervisor_spawn(&sv))
+    {
+        return 1;
+    }
+
+    struct epoll_event events[16];
+    for (;;)
+    {
+        int n = epoll_wait(sv.epoll_fd, events, sizeof(events) / sizeof(events[0]), supervisor_timeout(&sv));
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("epoll_wait");
+            supervisor_stop(&sv, SIGTERM);
+            return 1;
+        }
+
+        for (int i = 0; i < n; ++i)
+        {
+            const uint32_t value = WATCH_VALUE(events[i].data.u64);
+            int ret = 0;
+
+            switch (WATCH_KIND(events[i].data.u64))
+            {
+            case WATCH_SIGNAL:
+            {
+                struct signalfd_siginfo si;
+                if (read(sv.signal_fd, &si, sizeof(si)) != sizeof(si))
+                {
+                    break;
+                }
+                if (si.ssi_signo == SIGHUP)
+                {
+                    ret = supervisor_reload(&sv);
+                    break;
+                }
+                fprintf(stderr, "Got signal %u, stopping\n", si.ssi_signo);
+                return supervisor_stop(&sv, (int)si.ssi_signo);
+            }
+            case WATCH_CHILD:
+                ret = supervisor_reap(&sv, (pid_t)value);
+                break;
+            case WATCH_NOTIFY:
+                ret = supervisor_notify_ready(&sv);
+                break;
+            case WATCH_HANDLER:
+                ret = supervisor_reap_handler(&sv, &sv.handlers[value]);
+                break;
+            case WATCH_URING:
+                ret = supervisor_uring_ready(&sv);
+                break;
+            case WATCH_METRICS:
+                ret = metrics_serve(&sv.metrics);
+                break;
+            case WATCH_HANDOFF:
+                ret = handoff_serve(args, sv.handoff_fd);
+                break;
+            case WATCH_LISTENER:
+                if (args->accept)
+                {
+                    ret = supervisor_accept_ready(&sv, (int)value);
+                    break;
+                }
+                /* activity on one of listeners */
+                sv.last_activity = monotonic_ms();
+                if (sv.child.pid == 0 && !sv.restart_pending)
+                {
+                    ret = supervisor_respawn(&sv);
+                }
+                break;
+            }
+
+            if (ret)
+            {
+                /* children would be left on listeners nobody supervises */
+                supervisor_stop(&sv, SIGTERM);
+                return ret;
+            }
+        }
+
+        if (sv.child.pid && args->idle_exit_sec && !sv.idle_stop_sent
+            && monotonic_ms() - sv.last_activity >= (int64_t)args->idle_exit_sec * 1000)
+        {
+            fprintf(stderr, "Idle for %us, asking app (pid=%d) to exit\n", args->idle_exit_sec, sv.child.pid);
+            kill(sv.child.pid, SIGTERM);
+            sv.idle_stop_sent = 1;
+        }
+
+        if (sv.pending.pid && monotonic_ms() >= sv.pending_deadline)
+        {
+            fprintf(stderr, "New app pid=%d not ready in time, killing it\n", sv.pending.pid);
+            kill(sv.pending.pid, SIGKILL);
+            /* reaped as usual, no need to check again */
+            sv.pending_deadline = INT64_MAX;
+        }
+
+        if (sv.restart_pending && monotonic_ms() >= sv.restart_at)
+        {
+            /* OnDemand without Supervise: start only if something is queued */
+            sv.restart_pending = 0;
+            if (args->supervise ? supervisor_respawn(&sv) : supervisor_arm_listeners(&sv))
+            {
+                supervisor_stop(&sv, SIGTERM);
+                return 1;
+            }
+        }
+
+        if (sv.accept_rearm_size && monotonic_ms() >= sv.accept_rearm_at)
+        {
+            for (uint32_t i = 0; i < sv.accept_rearm_size; ++i)
+            {
+                if (supervisor_uring_arm(&sv, sv.accept_rearm[i]))
+                {
+                    supervisor_stop(&sv, SIGTERM);
+                    return 1;
+                }
+            }
+            sv.accept_rearm_size = 0;
+        }
+
+        for (uint32_t i = 0; i < sv.workers_size; ++i)
+        {
+            if (sv.workers[i].restart_pending && monotonic_ms() >= sv.workers[i].restart_at)
+            {
+                sv.workers[i].restart_pending = 0;
+                /* binary briefly missing mid-deploy: back off like for crash */
+                if (supervisor_spawn_worker(&sv, i)
+                    && (sv.workers[i].child.pid || supervisor_worker_restart(&sv, &sv.workers[i])))
+                {
+                    supervisor_stop(&sv, SIGTERM);
+                    return 1;
+                }
+            }
+        }
+
+        metrics_tick(&sv.metrics);
+    }
+}
+
+static int supervisor_timeout(const struct supervisor *sv)
+{
+    const struct arguments *args = sv->arguments;
+    int64_t deadline = -1;
+
+    if (sv->child.pid && args->idle_exit_sec && !sv->idle_stop_sent)
+    {
+        deadline = sv->last_activity + (int64_t)args->idle_exit_sec * 1000;
+    }
+
+    if (sv->restart_pending && (deadline < 0 || sv->restart_at < deadline))
+    {
+        deadline = sv->restart_at;
+    }
+
+    if (sv->pending.pid && sv->pending_deadline != INT64_MAX
+        && (deadline < 0 || sv->pending_deadline < deadline))
+    {
+        deadline = sv->pending_deadline;
+    }
+
+    if (sv->accept_rearm_size && (deadline < 0 || sv->accept_rearm_at < deadline))
+    {
+        deadline = sv->accept_rearm_at;
+    }
+
+    if (sv->metrics.next_write != INT64_MAX && (deadline < 0 || sv->metrics.next_write < deadline))
+    {
+        deadline = sv->metrics.next_write;
+    }
+
+    for (uint32_t i = 0; i < sv->workers_size; ++i)
+    {
+        if (sv->workers[i].restart_pending && (deadline < 0 || sv->workers[i].restart_at < deadline))
+        {
+            deadline = sv->workers[i].restart_at;
+        }
+    }
+
+    if (deadline < 0)
+    {
+        return -1;
+    }
+
+    int64_t now = monotonic_ms();
+    return deadline > now ? (int)(deadline - now) : 0;
+}
+
+static int supervisor_schedule_restart(struct supervisor *sv)
+{
+    const struct arguments *args = sv->arguments;
+    int64_t now = monotonic_ms();
+
+    /* app was running long enough, this is not a crash loop */
+    if (now - sv->started_at >= args->restart_max_ms)
+    {
+        sv->restart_delay = 0;
+    }
+
+    if (sv->restart_delay == 0)
+    {
+        sv->restart_delay = args->restart_ms;
+    }
+    else
+    {
+        sv->restart_delay *= 2;
+    }
+
+    if (sv->restart_delay > args->restart_max_ms)
+    {
+        sv->restart_delay = args->restart_max_ms;
+    }
+
+    if (args->supervise)
+    {
+        fprintf(stderr, "Restarting app in %ums\n", sv->restart_delay);
+    }
+    else
+    {
+        fprintf(stderr, "App crashed, ignoring activity for %ums\n", sv->restart_delay);
+    }
+    sv->restart_pending = 1;
+    sv->restart_at = now + sv->restart_delay;
+    return 0;
+}
+
+static int supervisor_watch(struct supervisor *sv, int fd, uint32_t events, enum watch_kind kind, uint32_t value)
+{
+    struct epoll_event ev = {.events = events, .data.u64 = WATCH(kind, value)};
+    if (epoll_ctl(sv->epoll_fd, EPOLL_CTL_ADD, fd, &ev))
+    {
+        perror("epoll_ctl");
+        return 1;
+    }
+    return 0;
+}
+
+static int supervisor_arm_listeners(struct supervisor *sv)
+{
+    /*
+        Without app: level triggered, wake up on anything queued.
+        With app: only edge triggered to track activity for IdleExitSec,
+        app will be accepting on the very same sockets.
+    */
+    uint32_t events = 0;
+    if (sv->child.pid == 0 && !sv->restart_pending)
+    {
+        events = EPOLLIN;
+    }
+    else if (sv->arguments->idle_exit_sec)
+    {
+        events = EPOLLIN | EPOLLET;
+    }
+
+    for (const struct listen_on *lo = &sv->arguments->listeners; lo != NULL; lo = lo->next)
+    {
+        if (!listen_on_pollable(lo))
+        {
+            continue;
+        }
+
+        struct epoll_event ev = {.events = events, .data.u64 = WATCH(WATCH_LISTENER, lo->fd)};
+        if (epoll_ctl(sv->epoll_fd, EPOLL_CTL_MOD, lo->fd, &ev))
+        {
+            perror("epoll_ctl");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int supervisor_fork_app(struct supervisor *sv, struct child *child, int worker)
+{
+    /* closed by successful exec, gets a byte when exec failed */
+    int exec_pipe[2];
+    if (pipe2(exec_pipe, O_CLOEXEC))
+    {
+        perror("pipe2");
+        return 1;
+    }
+
+    pid_t pid = profile_fork(&sv->arguments->profile);
+    if (pid < 0)
+    {
+        perror("fork");
+        close(exec_pipe[0]);
+        close(exec_pipe[1]);
+        return 1;
+    }
+
+    if (pid == 0)
+    {
+        sigprocmask(SIG_SETMASK, &sv->old_mask, NULL);
+        if ((worker < 0 || worker_pin(&sv->workers[worker], (uint32_t)worker) == 0)
+            && supervisor_fd_store_install(sv) == 0)
+        {
+            arguments_exec(sv->arguments, sv->app_argv);
+        }
+        (void)!write(exec_pipe[1], "", 1);
+        _exit(127);
+    }
+
+    /* exec takes a moment, and callers need to know it worked (reload) */
+    close(exec_pipe[1]);
+    char byte = 0;
+    ssize_t exec_failed = 0;
+    do
+    {
+        exec_failed = read(exec_pipe[0], &byte, 1);
+    } while (exec_failed < 0 && errno == EINTR);
+    close(exec_pipe[0]);
+    if (exec_failed > 0)
+    {
+        waitpid(pid, NULL, 0);
+        fprintf(stderr, "App pid=%d could not be started\n", pid);
+        return 1;
+    }
+
+    /* pidfd_open(2) always sets O_CLOEXEC */
+    int pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    if (pidfd < 0)
+    {
+        perror("pidfd_open");
+        return 1;
+    }
+
+    if (supervisor_watch(sv, pidfd, EPOLLIN, WATCH_CHILD, (uint32_t)pid))
+    {
+        return 1;
+    }
+
+    child->pid = pid;
+    child->pidfd = pidfd;
+    fprintf(stderr, "Started app pid=%d\n", pid);
+    return 0;
+}
+
+static int supervisor_spawn(struct supervisor *sv)
+{
+    /* failed start counts as crash right away, see supervisor_respawn */
+    sv->started_at = monotonic_ms();
+    if (supervisor_fork_app(sv, &sv->child, -1))
+    {
+        return 1;
+    }
+
+    sv->idle_stop_sent = 0;
+
+    return sv->arguments->on_demand ? supervisor_arm_listeners(sv) : 0;
+}
+
+static int supervisor_respawn(struct supervisor *sv)
+{
+    if (supervisor_spawn(sv) == 0)
+    {
+        return 0;
+    }
+
+    /* app is running, it is supervisor that broke */
+    if (sv->child.pid)
+    {
+        return 1;
+    }
+
+    /* binary briefly missing mid-deploy: keep listeners, try again later */
+    supervisor_schedule_restart(sv);
+    return sv->arguments->on_demand ? supervisor_arm_listeners(sv) : 0;
+}
+
+static int supervisor_reap(struct supervisor *sv, pid_t pid)
+{
+    int status = 0;
+    if (waitpid(pid, &status, 0) < 0)
+    {
+        perror("waitpid");
+        return 1;
+    }
+    fprintf(stderr, "App pid=%d exited, status=%d\n", pid, status);
+
+    for (uint32_t i = 0; i < sv->workers_size; ++i)
+    {
+        if (sv->workers[i].child.pid == pid)
+        {
+            return supervisor_reap_worker(sv, &sv->workers[i], status);
+        }
+    }
+
+    struct child *child = NULL;
+    if (pid == sv->child.pid)
+    {
+        child = &sv->child;
+    }
+    else if (pid == sv->pending.pid)
+    {
+        child = &sv->pending;
+    }
+    else
+    {
+        for (uint32_t i = 0; i < sv->draining_size; ++i)
+        {
+            if (sv->draining[i].pid == pid)
+            {
+                epoll_ctl(sv->epoll_fd, EPOLL_CTL_DEL, sv->draining[i].pidfd, NULL);
+                close(sv->draining[i].pidfd);
+                sv->draining[i] = sv->draining[--sv->draining_size];
+                return 0;
+            }
+        }
+        return 0;
+    }
+
+    epoll_ctl(sv->epoll_fd, EPOLL_CTL_DEL, child->pidfd, NULL);
+    close(child->pidfd);
+    child->pid = 0;
+    child->pidfd = -1;
+
+    if (child == &sv->pending)
+    {
+        fprintf(stderr, "Reload failed, new app exited before it was ready\n");
+    }
+
+    /* new app is on its way, or current one still serves */
+    if (sv->pending.pid || sv->child.pid)
+    {
+        return 0;
+    }
+
+    /* OnDemand app asked to leave due to idleness waits for next activity */
+    if (sv->arguments->supervise && !sv->idle_stop_sent)
+    {
+        supervisor_schedule_restart(sv);
+    }
+    /* crashed one would be started again right away for still queued connection */
+    else if (sv->arguments->on_demand && !sv->idle_stop_sent && !(WIFEXITED(status) && WEXITSTATUS(status) == 0))
+    {
+        supervisor_schedule_restart(sv);
+    }
+
+    return sv->arguments->on_demand ? supervisor_arm_listeners(sv) : 0;
+}
+
+static int supervisor_notify_setup(struct supervisor *sv)
+{
+    /* FD store needs somewhere to send FDSTORE=1 to, even with Type=simple */
+    if (!sv->arguments->notify && !sv->arguments->fd_store_max)
+    {
+        return 0;
+    }
+
+    sv->notify_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (sv->notify_fd < 0)
+    {
+        perror("notify socket");
+        return 1;
+    }
+
+    /* abstract socket: nothing to clean up, sd_notify understands '@' */
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    int len = snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "listen-like/%d/notify", getpid()); /* NOLINT */
+    socklen_t addr_len = offsetof(struct sockaddr_un, sun_path) + 1 + len;
+
+    if (bind(sv->notify_fd, (struct sockaddr *)&addr, addr_len))
+    {
+        perror("notify bind");
+        return 1;
+    }
+
+    /* sender pid is needed to tell apps apart */
+    if (set_sol(sv->notify_fd, SO_PASSCRED, 1))
+    {
+        perror("SO_PASSCRED");
+        return 1;
+    }
+
+    char env[sizeof(addr.sun_path) + 1] = {0};
+    snprintf(env, sizeof(env), "@%s", addr.sun_path + 1); /* NOLINT */
+    setenv("NOTIFY_SOCKET", env, 1);
+
+    return supervisor_watch(sv, sv->notify_fd, EPOLLIN, WATCH_NOTIFY, sv->notify_fd);
+}
+
+static int supervisor_notify_ready(struct supervisor *sv)
+{
+    for (;;)
+    {
+        char buf[4096];
+        struct iovec iov = {.iov_base = buf, .iov_len = sizeof(buf) - 1};
+        /* SCM_RIGHTS: up to SCM_MAX_FD descriptors with FDSTORE=1 */
+        union
+        {
+            char buf[CMSG_SPACE(sizeof(struct ucred)) + CMSG_SPACE(sizeof(int) * 253)];
+            struct cmsghdr align;
+        } control;
+        struct msghdr msg = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control.buf,
+            .msg_controllen = sizeof(control.buf),
+        };
+
+        ssize_t n = recvmsg(sv->notify_fd, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0)
+        {
+            return 0;
+        }
+        buf[n] = '\0';
+
+        pid_t sender = 0;
+        int *fds = NULL;
+        size_t fds_count = 0;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_CREDENTIALS)
+            {
+                struct ucred cred;
+                memcpy(&cred, CMSG_DATA(cmsg), sizeof(cred));
+                sender = cred.pid;
+            }
+            else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            {
+                fds = (int *)CMSG_DATA(cmsg);
+                fds_count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            }
+        }
+
+        /* newline separated VARIABLE=VALUE */
+        int fd_store = false;
+        int fd_store_remove = false;
+        const char *fd_name = "stored";
+        int from_app = sender != 0 && (sender == sv->child.pid || sender == sv->pending.pid);
+        for (uint32_t i = 0; sender != 0 && i < sv->workers_size; ++i)
+        {
+            from_app |= sender == sv->workers[i].child.pid;
+        }
+        char *tok_state = NULL;
+        for (char *line = strtok_r(buf, "\n", &tok_state); line != NULL; line = strtok_r(NULL, "\n", &tok_state))
+        {
+            if (strcmp(line, "FDSTORE=1") == 0)
+            {
+                fd_store = true;
+            }
+            else if (strcmp(line, "FDSTOREREMOVE=1") == 0)
+            {
+                fd_store_remove = true;
+            }
+            else if (strncmp(line, "FDNAME=", 7) == 0)
+            {
+                fd_name = line + 7;
+            }
+            else if (strcmp(line, "READY=1") == 0 && sender != 0 && sender == sv->pending.pid)
+            {
+                fprintf(stderr, "New app pid=%d is ready\n", sender);
+                if (supervisor_promote(sv))
+                {
+                    return 1;
+                }
+            }
+        }
+
+        if (fd_store && from_app && sv->arguments->fd_store_max)
+        {
+            supervisor_fd_store_add(sv, fds, fds_count, fd_name);
+        }
+        else
+        {
+            for (size_t i = 0; i < fds_count; ++i)
+            {
+                close(fds[i]);
+            }
+        }
+
+        if (fd_store_remove && from_app)
+        {
+            supervisor_fd_store_remove(sv, fd_name);
+        }
+    }
+}
+
+static void supervisor_fd_store_add(struct supervisor *sv, const int *fds, size_t count, const char *name)
+{
+    /* ':' separates $LISTEN_FDNAMES, such name would shift every following one */
+    const int valid_name = strlen(name) < sizeof(sv->fd_store->name) && strchr(name, ':') == NULL;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        struct stat st;
+        int keep = valid_name && sv->fd_store_size < sv->arguments->fd_store_max && fstat(fds[i], &st) == 0;
+
+        /* same file sent again on every start, keep only one */
+        for (uint32_t j = 0; keep && j < sv->fd_store_size; ++j)
+        {
+            struct stat stored;
+            if (fstat(sv->fd_store[j].fd, &stored) == 0 && stored.st_dev == st.st_dev && stored.st_ino == st.st_ino)
+            {
+                keep = false;
+            }
+        }
+
+        if (keep && sv->fd_store == NULL)
+        {
+            sv->fd_store = calloc(sv->arguments->fd_store_max, sizeof(*sv->fd_store));
+            keep = sv->fd_store != NULL;
+        }
+
+        if (!keep)
+        {
+            if (!valid_name || sv->fd_store_size >= sv->arguments->fd_store_max)
+            {
+                fprintf(stderr, "Not storing descriptor %s: %s\n", name, valid_name ? "store is full" : "invalid name");
+            }
+            close(fds[i]);
+            continue;
+        }
+
+        struct fd_store_entry *entry = &sv->fd_store[sv->fd_store_size++];
+        entry->fd = fds[i];
+        /* NOLINTNEXTLINE */
+        strcpy(entry->name, name);
+        fprintf(stderr, "Stored descriptor %s, %u in store\n", name, sv->fd_store_size);
+    }
+}
+
+static void supervisor_fd_store_remove(struct supervisor *sv, const char *name)
+{
+    for (uint32_t i = 0; i < sv->fd_store_size;)
+    {
+        if (strcmp(sv->fd_store[i].name, name) != 0)
+        {
+            ++i;
+            continue;
+        }
+
+        close(sv->fd_store[i].fd);
+        /* keep order, app might rely on it */
+        memmove(&sv->fd_store[i], &sv->fd_store[i + 1], (sv->fd_store_size - i - 1) * sizeof(*sv->fd_store));
+        --sv->fd_store_size;
+        fprintf(stderr, "Removed descriptor %s from store\n", name);
+    }
+}
+
+static int supervisor_fd_store_install(const struct supervisor *sv)
+{
+    /* runs in forked child, right before exec */
+    if (sv->fd_store_size == 0)
+    {
+        return 0;
+    }
+
+    const int listeners = listen_on_size((struct listen_on *)&sv->arguments->listeners);
+    const int first = 3 + listeners;
+
+    /* targets might be taken by supervisor descriptors, move out of the way first */
+    int *tmp = calloc(sv->fd_store_size, sizeof(*tmp));
+    if (tmp == NULL)
+    {
+        perror("calloc");
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < sv->fd_store_size; ++i)
+    {
+        tmp[i] = fcntl(sv->fd_store[i].fd, F_DUPFD_CLOEXEC, first + (int)sv->fd_store_size);
+        if (tmp[i] < 0)
+        {
+            perror("F_DUPFD");
+            return 1;
+        }
+    }
+
+    size_t names_len = strlen(getenv("LISTEN_FDNAMES") ? getenv("LISTEN_FDNAMES") : "") + 1;
+    for (uint32_t i = 0; i < sv->fd_store_size; ++i)
+    {
+        /* dup2 clears O_CLOEXEC on new descriptor */
+        if (dup2(tmp[i], first + (int)i) < 0)
+        {
+            perror("dup2");
+            return 1;
+        }
+        names_len += strlen(sv->fd_store[i].name) + 1;
+    }
+
+    char *names = malloc(names_len);
+    if (names == NULL)
+    {
+        perror("malloc");
+        return 1;
+    }
+
+    /* NOLINTNEXTLINE */
+    strcpy(names, getenv("LISTEN_FDNAMES") ? getenv("LISTEN_FDNAMES") : "");
+    for (uint32_t i = 0; i < sv->fd_store_size; ++i)
+    {
+        if (listeners || i)
+        {
+            /* NOLINTNEXTLINE */
+            strcat(names, ":");
+        }
+        /* NOLINTNEXTLINE */
+        strcat(names, sv->fd_store[i].name);
+    }
+    setenv("LISTEN_FDNAMES", names, 1);
+
+    char count[16] = {0};
+    /* NOLINTNEXTLINE */
+    snprintf(count, sizeof(count), "%d", listeners + (int)sv->fd_store_size);
+    setenv("LISTEN_FDS", count, 1);
+    return 0;
+}
+
+static int supervisor_reload(struct supervisor *sv)
+{
+    /* rotate Fast Open key, new key is used right away by listeners */
+    for (const struct listen_on *lo = &sv->arguments->listeners; lo != NULL; lo = lo->next)
+    {
+        if (lo->fast_open_key && set_fast_open_key(lo->fd, lo->fast_open_key))
+        {
+            perror("TCP_FASTOPEN_KEY");
+            fprintf(stderr, "Unable to load Fast Open key from %s, keeping old one\n", lo->fast_open_key);
+        }
+    }
+
+    if (sv->workers_size)
+    {
+        /* one by one would be nicer, but listeners keep queueing meanwhile anyway */
+        fprintf(stderr, "Got SIGHUP, restarting %u worker(s)\n", sv->workers_size);
+        for (uint32_t i = 0; i < sv->workers_size; ++i)
+        {
+            if (sv->workers[i].child.pid)
+            {
+                sv->workers[i].reloading = true;
+                kill(sv->workers[i].child.pid, SIGTERM);
+            }
+        }
+        return 0;
+    }
+
+    if (sv->arguments->accept || sv->child.pid == 0 || sv->pending.pid)
+    {
+        fprintf(stderr, "Got SIGHUP, nothing to reload\n");
+        return 0;
+    }
+
+    fprintf(stderr, "Got SIGHUP, starting new app\n");
+    if (supervisor_fork_app(sv, &sv->pending, -1))
+    {
+        /* old app was not asked to leave yet */
+        fprintf(stderr, "Reload failed, old app pid=%d keeps serving\n", sv->child.pid);
+        return 0;
+    }
+    sv->pending_deadline = monotonic_ms() + sv->arguments->timeout_start_ms;
+
+    return sv->arguments->notify ? 0 : supervisor_promote(sv);
+}
+
+static int supervisor_promote(struct supervisor *sv)
+{
+    /* old app drains in background, listeners are shared */
+    if (sv->child.pid)
+    {
+        fprintf(stderr, "Asking old app pid=%d to exit\n", sv->child.pid);
+        kill(sv->child.pid, SIGTERM);
+        sv->draining = realloc(sv->draining, (sv->draining_size + 1) * sizeof(*sv->draining));
+        sv->draining[sv->draining_size++] = sv->child;
+    }
 
-    case ARGP_KEY_ARG:
-        if (!state->quoted)
+    sv->child = sv->pending;
+    sv->pending.pid = 0;
+    sv->pending.pidfd = -1;
+    sv->idle_stop_sent = 0;
+    sv->started_at = monotonic_ms();
+    return 0;
+}
+
+static int supervisor_stop(struct supervisor *sv, int sig)
+{
+    for (uint32_t i = 0; i < sv->handlers_size; ++i)
+    {
+        if (sv->handlers[i].child.pid)
         {
-            fprintf(stderr, "Application to run and it's arguments should be set after --\n");
-            return ARGP_ERR_UNKNOWN;
+            kill(sv->handlers[i].child.pid, sig);
         }
-        if (state->arg_num == 0)
+    }
+    for (uint32_t i = 0; i < sv->handlers_size; ++i)
+    {
+        if (sv->handlers[i].child.pid)
         {
-            arguments->app_to_run = arg;
-            arguments->copy_args_from = state->next - 1;
-            state->next = state->argc;
+            waitpid(sv->handlers[i].child.pid, NULL, 0);
+        }
+    }
+    free(sv->handlers);
+    free(sv->accept_rearm);
+    uring_free(&sv->ring);
+
+    for (uint32_t i = 0; i < sv->workers_size; ++i)
+    {
+        if (sv->workers[i].child.pid)
+        {
+            kill(sv->workers[i].child.pid, sig);
+        }
+    }
+    for (uint32_t i = 0; i < sv->workers_size; ++i)
+    {
+        if (sv->workers[i].child.pid)
+        {
+            waitpid(sv->workers[i].child.pid, NULL, 0);
+        }
+    }
+    free(sv->workers);
+
+    for (uint32_t i = 0; i < sv->draining_size; ++i)
+    {
+        kill(sv->draining[i].pid, sig);
+    }
+    if (sv->pending.pid)
+    {
+        kill(sv->pending.pid, sig);
+    }
+    for (uint32_t i = 0; i < sv->draining_size; ++i)
+    {
+        waitpid(sv->draining[i].pid, NULL, 0);
+    }
+    if (sv->pending.pid)
+    {
+        waitpid(sv->pending.pid, NULL, 0);
+    }
+    free(sv->draining);
+
+    if (sv->child.pid == 0)
+    {
+        return 0;
+    }
+
+    int status = 0;
+    kill(sv->child.pid, sig);
+    if (waitpid(sv->child.pid, &status, 0) < 0)
+    {
+        perror("waitpid");
+        return 1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/* Workers impl */
+
+static int supervisor_workers_setup(struct supervisor *sv)
+{
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed))
+    {
+        perror("sched_getaffinity");
+        return 1;
+    }
+
+    /* single node: nothing to gain from memory policy */
+    char online[64] = {0};
+    FILE *f = fopen("/sys/devices/system/node/online", "re");
+    const int numa = f && fgets(online, sizeof(online), f) && strcmp(online, "0\n") != 0;
+    if (f)
+    {
+        fclose(f);
+    }
+
+    /* (node, cpu) pairs sorted, so contiguous slices stay within a node */
+    int cpus[CPU_SETSIZE][2];
+    int count = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (CPU_ISSET(cpu, &allowed))
+        {
+            cpus[count][0] = numa ? worker_cpu_node(cpu) : -1;
+            cpus[count][1] = cpu;
+            ++count;
+        }
+    }
+    qsort(cpus, count, sizeof(cpus[0]), worker_cpu_cmp);
+
+    sv->workers_size = sv->arguments->workers;
+    sv->workers = calloc(sv->workers_size, sizeof(*sv->workers));
+    if (sv->workers == NULL)
+    {
+        perror("calloc");
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < sv->workers_size; ++i)
+    {
+        struct worker *w = &sv->workers[i];
+        w->child = (struct child){.pid = 0, .pidfd = -1};
+        CPU_ZERO(&w->cpus);
+
+        /* more workers than CPUs: share them round robin */
+        int first = (int)((uint64_t)i * (uint64_t)count / sv->workers_size);
+        int last = (int)((uint64_t)(i + 1) * (uint64_t)count / sv->workers_size);
+        if (first == last)
+        {
+            first = (int)(i % (uint32_t)count);
+            last = first + 1;
+        }
+        for (int c = first; c < last; ++c)
+        {
+            CPU_SET(cpus[c][1], &w->cpus);
+        }
+        w->node = cpus[first][0];
+    }
+    return 0;
+}
+
+static int supervisor_spawn_worker(struct supervisor *sv, uint32_t index)
+{
+    struct worker *w = &sv->workers[index];
+    /* failed start counts as crash right away, see supervisor_worker_restart */
+    w->started_at = monotonic_ms();
+    if (supervisor_fork_app(sv, &w->child, (int)index))
+    {
+        return 1;
+    }
+    fprintf(stderr, "Worker %u is pid=%d, %d CPU(s), node %d\n", index, w->child.pid, CPU_COUNT(&w->cpus), w->node);
+    return 0;
+}
+
+static int supervisor_reap_worker(struct supervisor *sv, struct worker *w, int status)
+{
+    epoll_ctl(sv->epoll_fd, EPOLL_CTL_DEL, w->child.pidfd, NULL);
+    close(w->child.pidfd);
+    w->child.pid = 0;
+    w->child.pidfd = -1;
+    return supervisor_worker_restart(sv, w);
+}
+
+static int supervisor_worker_restart(struct supervisor *sv, struct worker *w)
+{
+    const struct arguments *args = sv->arguments;
+
+    /* same backoff as Supervise, per worker */
+    const int64_t now = monotonic_ms();
+    if (w->reloading || now - w->started_at >= args->restart_max_ms || w->restart_delay == 0)
+    {
+        w->reloading = false;
+        w->restart_delay = args->restart_ms;
+    }
+    else
+    {
+        w->restart_delay = w->restart_delay * 2 > args->restart_max_ms ? args->restart_max_ms : w->restart_delay * 2;
+    }
+
+    fprintf(stderr, "Restarting worker %u in %ums\n", (uint32_t)(w - sv->workers), w->restart_delay);
+    w->restart_pending = 1;
+    w->restart_at = now + w->restart_delay;
+    return 0;
+}
+
+static int worker_cpu_node(int cpu)
+{
+    /* cpuN/nodeM symlink tells which node CPU belongs to */
+    char path[64];
+    /* NOLINTNEXTLINE */
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+    {
+        return -1;
+    }
+
+    int node = -1;
+    for (struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir))
+    {
+        if (strncmp(entry->d_name, "node", 4) == 0 && isdigit((unsigned char)entry->d_name[4]))
+        {
+            node = atoi(entry->d_name + 4);
             break;
         }
-        fprintf(stderr, "SHOULD NET BE HERE: next=%d\n", state->next);
-        break;
-    case ARGP_KEY_END:
-        if (state->arg_num < 1)
+    }
+    closedir(dir);
+    return node;
+}
+
+static int worker_cpu_cmp(const void *a, const void *b)
+{
+    const int *lhs = a;
+    const int *rhs = b;
+    return lhs[0] != rhs[0] ? lhs[0] - rhs[0] : lhs[1] - rhs[1];
+}
+
+static int worker_pin(const struct worker *w, uint32_t index)
+{
+    /* runs in forked worker, right before exec */
+    if (CPU_COUNT(&w->cpus) && sched_setaffinity(0, sizeof(w->cpus), &w->cpus))
+    {
+        perror("sched_setaffinity");
+        return 1;
+    }
+
+    /* preferred, not bound: full node means slower memory, not OOM kill */
+    if (w->node >= 0)
+    {
+        unsigned long nodes[16] = {0};
+        const unsigned long bits = sizeof(nodes[0]) * 8;
+        if ((unsigned long)w->node < bits * 16)
         {
-            // argp_err_exit_status = EINVAL;
-            argp_state_help(state, stdout, ARGP_HELP_STD_HELP | ARGP_HELP_EXIT_ERR);
-            argp_error(state, "missing whay you want to run");
-            return ARGP_ERR_UNKNOWN;
+            nodes[w->node / bits] |= 1ul << (w->node % bits);
+        }
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodes, bits * 16) && errno != ENOSYS)
+        {
+            perror("set_mempolicy");
+            return 1;
+        }
+    }
+
+    char tmp[16] = {0};
+    /* NOLINTNEXTLINE */
+    snprintf(tmp, sizeof(tmp), "%u", index);
+    setenv("LISTEN_WORKER_INDEX", tmp, 1);
+    return 0;
+}
+
+/* Accept=yes impl */
+
+static int supervisor_accept_setup(struct supervisor *sv)
+{
+    const struct arguments *args = sv->arguments;
+
+    sv->handlers_size = args->max_connections + args->spawn_pool;
+    sv->handlers = calloc(sv->handlers_size, sizeof(*sv->handlers));
+    for (uint32_t i = 0; i < sv->handlers_size; ++i)
+    {
+        sv->handlers[i].child.pidfd = -1;
+        sv->handlers[i].sock = -1;
+    }
+
+    /* apps get only connection, never listeners */
+    for (const struct listen_on *lo = &args->listeners; lo != NULL; lo = lo->next)
+    {
+        if (lo->kind != LISTEN_ON_SOCKET)
+        {
+            continue;
+        }
+        if (fcntl(lo->fd, F_SETFD, FD_CLOEXEC)
+            || fcntl(lo->fd, F_SETFL, fcntl(lo->fd, F_GETFL) | O_NONBLOCK))
+        {
+            perror("fcntl");
+            return 1;
+        }
+    }
+
+    sv->use_uring = uring_init(&sv->ring, 64) == 0;
+    if (sv->use_uring)
+    {
+        sv->accept_rearm = calloc(listen_on_size((struct listen_on *)&args->listeners), sizeof(*sv->accept_rearm));
+        sv->accept_rearm_at = INT64_MAX;
+        if (sv->accept_rearm == NULL
+            || supervisor_watch(sv, sv->ring.fd, EPOLLIN, WATCH_URING, sv->ring.fd))
+        {
+            return 1;
+        }
+        for (const struct listen_on *lo = &args->listeners; lo != NULL; lo = lo->next)
+        {
+            if (lo->kind == LISTEN_ON_SOCKET && supervisor_uring_arm(sv, lo->fd))
+            {
+                return 1;
+            }
+        }
+        fprintf(stderr, "Accepting with io_uring multishot accept\n");
+    }
+    else
+    {
+        for (const struct listen_on *lo = &args->listeners; lo != NULL; lo = lo->next)
+        {
+            if (lo->kind == LISTEN_ON_SOCKET && supervisor_watch(sv, lo->fd, EPOLLIN, WATCH_LISTENER, lo->fd))
+            {
+                return 1;
+            }
+        }
+        fprintf(stderr, "Accepting with epoll\n");
+    }
+
+    return supervisor_fill_pool(sv);
+}
+
+static int supervisor_accept_ready(struct supervisor *sv, int fd)
+{
+    for (;;)
+    {
+        int conn = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+        if (conn < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            {
+                return 0;
+            }
+            /* ECONNABORTED and friends, nothing fatal for listener */
+            perror("accept4");
+            return 0;
+        }
+
+        if (supervisor_dispatch(sv, conn))
+        {
+            return 1;
+        }
+    }
+}
+
+static int supervisor_uring_arm(struct supervisor *sv, int fd)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&sv->ring);
+    if (sqe == NULL)
+    {
+        fprintf(stderr, "io_uring submission queue is full\n");
+        return 1;
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = (uint64_t)fd;
+
+    int ret = uring_submit(&sv->ring, 0);
+    if (ret < 0)
+    {
+        errno = -ret;
+        perror("io_uring_enter");
+        return 1;
+    }
+    return 0;
+}
+
+static int supervisor_uring_ready(struct supervisor *sv)
+{
+    struct io_uring_cqe *cqe = NULL;
+    while ((cqe = uring_peek_cqe(&sv->ring)) != NULL)
+    {
+        const int fd = (int)cqe->user_data;
+        const int res = cqe->res;
+        const int more = cqe->flags & IORING_CQE_F_MORE;
+        uring_cqe_seen(&sv->ring);
+
+        if (res == -EINVAL && !more)
+        {
+            /* kernel without multishot accept, use epoll for this listener */
+            fprintf(stderr, "Multishot accept not supported, falling back to epoll\n");
+            if (supervisor_watch(sv, fd, EPOLLIN, WATCH_LISTENER, fd))
+            {
+                return 1;
+            }
+            continue;
+        }
+
+        if (res >= 0 && supervisor_dispatch(sv, res))
+        {
+            return 1;
+        }
+
+        /* posting it again right away would fail the same, over and over */
+        if ((res == -EMFILE || res == -ENFILE) && !more)
+        {
+            fprintf(stderr, "accept: %s, trying again in %ums\n", strerror(-res), ACCEPT_REARM_MS);
+            if (sv->accept_rearm_size == 0)
+            {
+                sv->accept_rearm_at = monotonic_ms() + ACCEPT_REARM_MS;
+            }
+            sv->accept_rearm[sv->accept_rearm_size++] = fd;
+            continue;
+        }
+
+        /* multishot request finished (eg. -ENOBUFS), post it again */
+        if (!more && supervisor_uring_arm(sv, fd))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int supervisor_dispatch(struct supervisor *sv, int conn)
+{
+    if (sv->active >= sv->arguments->max_connections)
+    {
+        fprintf(stderr, "MaxConnections=%u reached, refusing connection\n", sv->arguments->max_connections);
+        close(conn);
+        return 0;
+    }
+
+    struct handler *h = NULL;
+    for (uint32_t i = 0; i < sv->handlers_size; ++i)
+    {
+        if (sv->handlers[i].sock >= 0)
+        {
+            h = &sv->handlers[i];
+            break;
+        }
+    }
+
+    /* pool exhausted, pay for fork() on request path */
+    if (h == NULL)
+    {
+        for (uint32_t i = 0; i < sv->handlers_size && h == NULL; ++i)
+        {
+            if (sv->handlers[i].child.pid == 0)
+            {
+                h = &sv->handlers[i];
+            }
+        }
+        if (h == NULL || supervisor_spawn_handler(sv, h))
+        {
+            close(conn);
+            return h == NULL ? 0 : 1;
+        }
+        /* fork() or socketpair() failed for now, connection is lost, not launcher */
+        if (h->sock < 0)
+        {
+            fprintf(stderr, "No handler for connection, closing it\n");
+            close(conn);
+            return 0;
+        }
+    }
+
+    char dummy = 0;
+    struct iovec iov = {.iov_base = &dummy, .iov_len = sizeof(dummy)};
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &conn, sizeof(int));
+
+    if (sendmsg(h->sock, &msg, MSG_NOSIGNAL) < 0)
+    {
+        /* handler died in the meantime, its pidfd will tell us soon */
+        perror("sendmsg");
+    }
+    else
+    {
+        h->busy = true;
+        ++sv->active;
+    }
+
+    close(conn);
+    close(h->sock);
+    h->sock = -1;
+    --sv->idle;
+
+    return supervisor_fill_pool(sv);
+}
+
+static int supervisor_fill_pool(struct supervisor *sv)
+{
+    for (uint32_t i = 0; i < sv->handlers_size && sv->idle < sv->arguments->spawn_pool; ++i)
+    {
+        if (sv->handlers[i].child.pid)
+        {
+            continue;
+        }
+        if (supervisor_spawn_handler(sv, &sv->handlers[i]))
+        {
+            return 1;
+        }
+        /* no use trying others now, pool is filled up again on next connection or exit */
+        if (sv->handlers[i].child.pid == 0)
+        {
+            break;
         }
-        break;
-    default:
-        return ARGP_ERR_UNKNOWN;
     }
     return 0;
 }
 
-/* misc impl */
-
-static int open_or_mkdir(int fd, const char *name, mode_t mode)
+static int supervisor_spawn_handler(struct supervisor *sv, struct handler *h)
 {
-    if (mkdirat(fd, name, mode) && errno != EEXIST)
+    /* EMFILE, EAGAIN at RLIMIT_NPROC: under load, not fatal, h stays empty */
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair))
     {
-        return -1;
+        perror("socketpair");
+        return 0;
     }
 
-    int dir = openat(fd, name, O_CLOEXEC | O_DIRECTORY | O_RDONLY);
-    return dir;
-}
-
-static int set_sol(int fd, int arg, uint32_t opt)
-{
-    return setsockopt(fd, SOL_SOCKET, arg, &opt, sizeof(opt));
-}
+    pid_t pid = profile_fork(&sv->arguments->profile);
+    if (pid < 0)
+    {
+        perror("fork");
+        close(pair[0]);
+        close(pair[1]);
+        return 0;
+    }
 
-/* be warned: this is deprecated, and wild thing might happen */
-int set_tos(int fd, int tos)
-{
-    int masked = tos & IPTOS_TOS_MASK;
-    if (masked != tos)
+    if (pid == 0)
     {
-        fprintf(stderr, "Invalid tos value: %d (%d)\n", tos, masked);
-        return EINVAL;
+        sigprocmask(SIG_SETMASK, &sv->old_mask, NULL);
+        close(pair[0]);
+        handler_wait_for_connection(sv->arguments, sv->app_argv, pair[1]);
+        _exit(127);
     }
-    return setsockopt(fd, IPPROTO_IP, IP_TOS, &masked, sizeof(masked));
-}
+    close(pair[1]);
 
-int set_dscp(int fd, int val)
-{
-    if (val > 63)
+    int pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    if (pidfd < 0)
     {
-        return EINVAL;
+        perror("pidfd_open");
+        return 1;
     }
-    /* shift: two first bits are ECN (Explicit Congestion Notification) */
-    val = val << 2;
-    int ret = setsockopt(fd, IPPROTO_IP, IP_TOS, &val, sizeof val);
-    /* might not be IPv4, try IPv6 */
-    if (ret)
+
+    if (supervisor_watch(sv, pidfd, EPOLLIN, WATCH_HANDLER, (uint32_t)(h - sv->handlers)))
     {
-        return setsockopt(fd, IPPROTO_IPV6, IPV6_TCLASS, &val, sizeof val);
+        return 1;
     }
+
+    h->child.pid = pid;
+    h->child.pidfd = pidfd;
+    h->sock = pair[0];
+    ++sv->idle;
     return 0;
 }
 
-int set_ttl(int fd, int ttl)
+static int supervisor_reap_handler(struct supervisor *sv, struct handler *h)
 {
-    int ret = setsockopt(fd, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl));
-    if (ret)
+    int status = 0;
+    if (waitpid(h->child.pid, &status, 0) < 0)
     {
-        return setsockopt(fd, IPPROTO_IP, IPV6_HOPLIMIT, &ttl, sizeof(ttl));
+        perror("waitpid");
+        return 1;
     }
-    return 0;
-}
 
-static int set_tcpopt(int fd, int arg, int val)
-{
-    return setsockopt(fd, SOL_TCP, arg, &val, sizeof(val));
-}
+    epoll_ctl(sv->epoll_fd, EPOLL_CTL_DEL, h->child.pidfd, NULL);
+    close(h->child.pidfd);
 
-static int lock_unix_socket(const struct sockaddr_un *unix_addr)
-{
-    if (unix_addr->sun_path[0] == '\0')
+    if (h->sock >= 0)
     {
-        return 0;
+        /* never got connection */
+        close(h->sock);
+        h->sock = -1;
+        --sv->idle;
+    }
+    /* send failed: neither idle nor active any more */
+    else if (h->busy)
+    {
+        h->busy = false;
+        --sv->active;
     }
 
-    // if name is not abstract check lock
-    char path[PATH_MAX];
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 127)
+    {
+        fprintf(stderr, "App pid=%d could not be executed\n", h->child.pid);
+    }
 
-    /* copy is needed, dirname will destroy content of passed string */
-    char sun_cpy1[sizeof(unix_addr->sun_path)];
-    char sun_cpy2[sizeof(unix_addr->sun_path)];
+    h->child.pid = 0;
+    h->child.pidfd = -1;
 
-    memcpy(sun_cpy1, unix_addr->sun_path, sizeof(sun_cpy1)); /* NOLINT */
-    memcpy(sun_cpy2, unix_addr->sun_path, sizeof(sun_cpy1)); /* NOLINT */
+    return supervisor_fill_pool(sv);
+}
 
-    char *dir_name = dirname(sun_cpy1);
-    char *file_name = basename(sun_cpy2);
+static void handler_wait_for_connection(const struct arguments *args, char *const app_argv[], int sock)
+{
+    char dummy = 0;
+    struct iovec iov = {.iov_base = &dummy, .iov_len = sizeof(dummy)};
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
 
-    /* NOLINTNEXTLINE */
-    snprintf(path, sizeof(path) - 1, "%s/~%s", dir_name, file_name);
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (n <= 0 || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS)
+    {
+        /* supervisor is gone, nothing to do */
+        _exit(0);
+    }
 
-    /*
-        this is 'hackinsh' as now we have leaking descriptor to app,
-        that is not aware of leaked descriptor, and listening sockets
-        might be spread all around.
-    */
-    int flock_fd = open(path, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+    int conn = -1;
+    memcpy(&conn, CMSG_DATA(cmsg), sizeof(int));
 
-    /* there is now simple way for using flock:
-        - passing 'flock' fd to child (after expected FDs)
-        - faking flock like 'pid' file
-    */
-    if (flock_fd < 0)
+    /* dup2 clears O_CLOEXEC */
+    if (dup2(conn, 3) < 0)
     {
-        perror("open");
-        fprintf(stderr, "Unable to create lock file: %s\n", path);
-        return 1;
+        perror("dup2");
+        _exit(1);
     }
 
-    if (flock(flock_fd, LOCK_EX | LOCK_NB))
+    setenv("LISTEN_FDS", "1", 1);
+    setenv("LISTEN_FDNAMES", "connection", 1);
+
+    struct sockaddr_storage remote = {0};
+    socklen_t remote_len = sizeof(remote);
+    char addr[INET6_ADDRSTRLEN] = {0};
+    char port[8] = {0};
+    if (getpeername(3, (struct sockaddr *)&remote, &remote_len) == 0)
     {
-        perror("flock");
-        fprintf(stderr, "Someone else is using socket: %s\n", unix_addr->sun_path);
-        return 1;
+        if (remote.ss_family == AF_INET)
+        {
+            struct sockaddr_in *in = (struct sockaddr_in *)&remote;
+            inet_ntop(AF_INET, &in->sin_addr, addr, sizeof(addr));
+            snprintf(port, sizeof(port), "%u", ntohs(in->sin_port)); /* NOLINT */
+        }
+        else if (remote.ss_family == AF_INET6)
+        {
+            struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&remote;
+            inet_ntop(AF_INET6, &in6->sin6_addr, addr, sizeof(addr));
+            snprintf(port, sizeof(port), "%u", ntohs(in6->sin6_port)); /* NOLINT */
+        }
     }
 
-    int ret = unlink(unix_addr->sun_path);
-    if (ret != 0 && errno != ENOENT)
+    if (addr[0])
     {
-        perror("unlink");
-        fprintf(stderr, "Unable to unlink socket file: %s\n", unix_addr->sun_path);
-        return 1;
+        setenv("REMOTE_ADDR", addr, 1);
+        setenv("REMOTE_PORT", port, 1);
     }
-    return 0;
+
+    arguments_exec(args, app_argv);
 }
 
 /* main */
@@ -960,6 +6743,7 @@ int main(int argc, char *argv[])
         FOR THE LOVE OF... ENSURE ALL DESCRIPTORS NOT MEANT TO BE PASSED DOWN
         ARE USING O_CLOEXEC
     */
+    struct trace_event span = trace_begin("parse", "", 0);
     argp_program_version_hook = version_printer;
     struct arguments arguments = {0};
     arguments.socket_mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH; /* 666 */
@@ -967,12 +6751,29 @@ int main(int argc, char *argv[])
     arguments.user = getuid();
     arguments.group = getgid();
     arguments.backlog = 128;
+    arguments.fd_name = "unknown";
+    arguments.max_connections = 64;
+    arguments.spawn_pool = 4;
+    arguments.restart_ms = 100;
+    arguments.restart_max_ms = 10000;
+    arguments.timeout_start_ms = 90000;
+    arguments.metrics_interval_ms = 15000;
+    arguments.profile.sched_policy = -1;
+    arguments.profile.io_class = -1;
+    arguments.profile.io_priority = 4;
+    arguments.profile.cgroup_fd = -1;
+    arguments.connect_timeout_ms = 5000;
+    arguments.xdp_frame_size = 4096;
+    arguments.xdp_frame_count = 4096;
+    arguments.xdp_ring_size = 2048;
 
     if (argp_parse(&argp, argc, argv, 0, 0, &arguments))
     {
         argp_help(&argp, stderr, ARGP_HELP_STD_HELP, argv[0]);
         exit(1);
     }
+    trace_end(&span);
+    startup_trace.enabled = arguments.trace_startup != NULL;
 
     if (arguments.app_to_run == NULL || strlen(arguments.app_to_run) == 0)
     {
@@ -980,6 +6781,52 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
+    if (arguments.accept)
+    {
+        for (struct listen_on *lo = &arguments.listeners; lo != NULL; lo = lo->next)
+        {
+            /* ConnectStream is SOCK_STREAM too, but there is nothing to accept on it */
+            if (lo->kind != LISTEN_ON_SOCKET || (lo->socket_type != SOCK_STREAM && lo->socket_type != SOCK_SEQPACKET))
+            {
+                fprintf(stderr, "Accept=yes works only with ListenStream and ListenSequentialPacket: %s\n", lo->socket_listen);
+                exit(1);
+            }
+        }
+
+        if (arguments.max_connections == 0)
+        {
+            fprintf(stderr, "MaxConnections must be at least 1\n");
+            exit(1);
+        }
+    }
+
+    const struct exec_profile *profile = &arguments.profile;
+    if (!profile->slice
+        && (profile->cpu_weight || profile->cpu_quota_percent || profile->memory_high || profile->memory_max
+            || profile->io_weight || profile->allowed_cpus))
+    {
+        fprintf(stderr, "CPUWeight, CPUQuota, MemoryHigh, MemoryMax, IOWeight and AllowedCPUs need --Slice\n");
+        exit(1);
+    }
+
+    if (arguments.workers)
+    {
+        if (arguments.accept || arguments.on_demand)
+        {
+            fprintf(stderr, "Workers do not go together with Accept=yes nor OnDemand\n");
+            exit(1);
+        }
+        /* workers are restarted same way */
+        arguments.supervise = 1;
+    }
+
+    /* somebody has to stay around holding listeners */
+    if (arguments.handoff_socket && !arguments.accept && !arguments.on_demand && !arguments.supervise)
+    {
+        fprintf(stderr, "HandoffSocket needs --Supervise, --OnDemand or --Accept\n");
+        exit(1);
+    }
+
     fprintf(stderr, "App to run: %s\n", arguments.app_to_run);
     fprintf(stderr, "Arguments: ");
     for (int i = arguments.copy_args_from; i < argc; ++i)
@@ -988,78 +6835,325 @@ int main(int argc, char *argv[])
     }
     fprintf(stderr, "\n");
 
+    /* listeners and accepted connections count against LimitNOFILE too */
+    span = trace_begin("limits", "", 0);
+    if (profile_apply_limits(&arguments.profile))
+    {
+        exit(1);
+    }
+    trace_end(&span);
+
+    span = trace_begin("expand", "", 0);
+    /* before ReusePortGroup, every port of range gets its own group */
+    for (struct listen_on *lo = &arguments.listeners; lo != NULL; lo = lo->next)
+    {
+        if (listen_on_port_range(lo) || listen_on_connect_count(lo, &arguments.listeners))
+        {
+            exit(1);
+        }
+    }
+
+    if (arguments.reuse_port_group > 1)
+    {
+        for (struct listen_on *lo = &arguments.listeners; lo != NULL; lo = lo->next)
+        {
+            if (listen_on_reuse_port_group(lo, arguments.reuse_port_group))
+            {
+                exit(1);
+            }
+            /* skip freshly created clones */
+            const uint32_t group = lo->reuse_port_group;
+            for (uint32_t i = 1; i < group; ++i)
+            {
+                lo = lo->next;
+            }
+        }
+    }
+
+    trace_end(&span);
+
+    /* once, before any listener is set up */
+    for (struct listen_on *lo = &arguments.listeners; lo != NULL; lo = lo->next)
+    {
+        if (lo->reuse_port_migrate)
+        {
+            if (reuseport_migrate_setup(&arguments.listeners, arguments.reuse_port_group > 1))
+            {
+                exit(1);
+            }
+            break;
+        }
+    }
+
+    /* adopted ones are set up already, everything below skips them */
+    span = trace_begin("inherit", arguments.inherit_from ? arguments.inherit_from : "", 0);
+    if (arguments.inherit_from && handoff_inherit(&arguments.listeners, arguments.inherit_from))
+    {
+        exit(1);
+    }
+    trace_end(&span);
+
+    /* plain inet listeners in io_uring batches, ENOSYS: all with syscalls below */
+    span = trace_begin("uring_batch", "", 0);
+    int batched = listen_on_setup_uring(&arguments.listeners, arguments.backlog);
+    if (batched && batched != ENOSYS)
+    {
+        exit(1);
+    }
+    trace_end(&span);
+
     for (struct listen_on *lo = &arguments.listeners; lo != NULL;)
     {
+        if (lo->kind == LISTEN_ON_AUX)
+        {
+            lo = lo->next;
+            continue;
+        }
+
+        if (lo->kind == LISTEN_ON_FIFO || lo->kind == LISTEN_ON_MQUEUE)
+        {
+            const int fifo = lo->kind == LISTEN_ON_FIFO;
+            fprintf(stderr, "Listening: %s, %s\n", lo->socket_listen, fifo ? "fifo" : "message queue");
+            span = trace_begin(fifo ? "fifo" : "mqueue", lo->socket_listen, 0);
+            if (fifo ? listen_on_setup_fifo(lo, &arguments) : listen_on_setup_mqueue(lo, &arguments))
+            {
+                exit(1);
+            }
+            trace_end(&span);
+            lo = lo->next;
+            continue;
+        }
+
         fprintf(stderr,
-            "Listening: %s, %s(%s, %s)\n",
+            "%s: %s, %s(%s, %s)\n",
+            lo->kind == LISTEN_ON_CONNECT ? "Connecting" : "Listening",
             lo->socket_listen,
             listen_on_type(lo),
             listen_on_proto(lo),
             listen_on_family_to_text(lo)
             );
+
+        if (lo->kind == LISTEN_ON_XDP)
+        {
+            span = trace_begin("xdp", lo->socket_listen, 0);
+            if (listen_on_setup_xdp(lo, &arguments))
+            {
+                exit(1);
+            }
+            trace_end(&span);
+            lo = lo->next;
+            continue;
+        }
+
+        const uint16_t port = listen_on_port(lo);
+        if (lo->kind == LISTEN_ON_CONNECT)
+        {
+            span = trace_begin("connect", lo->socket_listen, port);
+            if (listen_on_connect(lo, &arguments))
+            {
+                exit(1);
+            }
+            trace_end(&span);
+            lo = lo->next;
+            continue;
+        }
+
+        if (lo->set_up)
+        {
+            lo = lo->next;
+            continue;
+        }
+
+        /* io_uring might have created it already */
+        span = trace_begin("socket", lo->socket_listen, port);
+        if (lo->fd < 0)
+        {
+            lo->fd = socket(lo->addr.ss_family, lo->socket_type, lo->socket_protocol);
+        }
+        if (lo->fd < 0)
+        {
+            perror("socket");
+            exit(1);
+        }
+        trace_end(&span);
+
         // check if this is unix socket, wchich may require locking
         if (lo->addr.ss_family == AF_UNIX)
         {
             // create parent directiries
             struct sockaddr_un *unix_addr = (struct sockaddr_un *)&lo->addr;
+            span = trace_begin("create_path", lo->socket_listen, 0);
             if (arguments_create_path(unix_addr->sun_path, &arguments))
             {
                 exit(1);
             }
+            trace_end(&span);
 
-            if (arguments.lock_unix_socket && lock_unix_socket(unix_addr))
+            span = trace_begin("lock", lo->socket_listen, 0);
+            if (arguments.lock_unix_socket && lock_unix_socket(lo))
             {
                 exit(1);
             }
+            trace_end(&span);
         }
 
+        span = trace_begin("sockopts", lo->socket_listen, port);
         if (listen_on_set_fd_options(lo))
         {
             exit(1);
         }
+        trace_end(&span);
 
+        span = trace_begin("bind", lo->socket_listen, port);
         if (bind(lo->fd, (struct sockaddr *)&lo->addr, lo->addr_len))
         {
             perror("bind");
             exit(1);
         }
+        trace_end(&span);
 
-        /* listen is not working on: UDP*/
-        if (lo->socket_protocol != IPPROTO_UDP)
+        /* listen is not working on: UDP, nor any other datagram socket */
+        if (lo->socket_type != SOCK_DGRAM)
         {
+            span = trace_begin("listen", lo->socket_listen, port);
             if (listen(lo->fd, arguments.backlog))
             {
                 perror("listen");
                 exit(1);
             }
+
+            /*
+                Not before bind: socket with group of its own can not join
+                group of other process. Once listening, program replaces one
+                of whole group, launchers sharing port set the same one.
+            */
+            if (lo->reuse_port_migrate && reuseport_migrate_prog >= 0 && lo->socket_type == SOCK_STREAM
+                && (lo->addr.ss_family == AF_INET || lo->addr.ss_family == AF_INET6)
+                && setsockopt(lo->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_EBPF, &reuseport_migrate_prog,
+                              sizeof(reuseport_migrate_prog)))
+            {
+                perror("SO_ATTACH_REUSEPORT_EBPF");
+                exit(1);
+            }
+            trace_end(&span);
         }
 
+        lo = lo->next;
+    }
+
+    /* sockets hold their own reference */
+    if (reuseport_migrate_prog >= 0)
+    {
+        close(reuseport_migrate_prog);
+        reuseport_migrate_prog = -1;
+    }
+
+    /* listeners are ready by now, so is any upstream that connects back */
+    span = trace_begin("connect_wait", "", 0);
+    if (listen_on_connect_wait(&arguments.listeners, arguments.connect_timeout_ms))
+    {
+        exit(1);
+    }
+    trace_end(&span);
+
+    span = trace_begin("arrange_fds", "", 0);
+    if (listen_on_arrange_fds(&arguments.listeners))
+    {
+        exit(1);
+    }
+    trace_end(&span);
+
+    /* after listeners took 3, 4, ..., so its descriptor is not overwritten */
+    span = trace_begin("cgroup", arguments.profile.slice ? arguments.profile.slice : "", 0);
+    if (arguments.profile.slice && profile_cgroup_setup(&arguments.profile))
+    {
+        exit(1);
+    }
+    trace_end(&span);
+
+    for (struct listen_on *lo = &arguments.listeners; lo != NULL; lo = lo->next)
+    {
         fprintf(stderr, "ACTIVE FD=%d\n", lo->fd);
 
-        lo = lo->next;
+        struct stat st;
+        if (fstat(lo->fd, &st) == 0)
+        {
+            lo->ino = st.st_ino;
+        }
+
+        /* 0 until first packet went through NAPI, still worth knowing */
+        uint32_t napi_id = 0;
+        socklen_t napi_id_len = sizeof(napi_id);
+        if ((lo->addr.ss_family == AF_INET || lo->addr.ss_family == AF_INET6)
+            && getsockopt(lo->fd, SOL_SOCKET, SO_INCOMING_NAPI_ID, &napi_id, &napi_id_len) == 0)
+        {
+            fprintf(stderr, "NAPI ID FD=%d: %u\n", lo->fd, napi_id);
+        }
     }
 
-    /* mimic systemd */
+    /* mimic systemd, LISTEN_PID is set right before exec */
     char tmp[16] = {0};
-    snprintf(tmp, sizeof(tmp) - 1, "%d", getpid()); /* NOLINT */
-    setenv("LISTEN_PID", tmp, 1);
-
     /* NOLINTNEXTLINE */
     snprintf(tmp, sizeof(tmp) - 1, "%d", listen_on_size(&arguments.listeners));
     setenv("LISTEN_FDS", tmp, 1);
 
-    setenv("LISTEN_FDNAMES", "", 1);
+    char *fd_names = listen_on_fd_names(&arguments.listeners, arguments.fd_name);
+    setenv("LISTEN_FDNAMES", fd_names, 1);
+    free(fd_names);
+
+    for (struct listen_on *lo = &arguments.listeners; lo != NULL; lo = lo->next)
+    {
+        if (lo->kind == LISTEN_ON_XDP)
+        {
+            /* NOLINTNEXTLINE */
+            snprintf(tmp, sizeof(tmp) - 1, "%u", arguments.xdp_frame_size);
+            setenv("LISTEN_XDP_FRAME_SIZE", tmp, 1);
+            break;
+        }
+    }
+
+    if (arguments.accept || arguments.on_demand || arguments.supervise)
+    {
+        /* supervisor takes over, app starts whenever it decides so */
+        span = trace_begin("supervisor", "", 0);
+        trace_end(&span);
+        if (arguments.trace_startup && trace_write(arguments.trace_startup))
+        {
+            exit(1);
+        }
+
+        int ret = supervisor_run(&arguments, argv + arguments.copy_args_from);
+        arguments_free(&arguments);
+        return ret;
+    }
+
+    if (arguments.metrics_socket || arguments.metrics_file)
+    {
+        struct metrics metrics;
+        if (metrics_setup(&metrics, &arguments) || metrics_spawn_helper(&metrics))
+        {
+            exit(1);
+        }
+    }
 
-    struct rlimit limits = {0};
-    if (getrlimit(RLIMIT_NOFILE, &limits))
+    /* exec itself can not be timed from here, USDT probe marks it */
+    span = trace_begin("exec", arguments.app_to_run, 0);
+    trace_end(&span);
+    if (arguments.trace_startup && trace_write(arguments.trace_startup))
     {
-        perror("getrlimit");
         exit(1);
     }
 
     /* cleanup mess */
     arguments_free(&arguments);
 
+    /* no fork here, launcher becomes app */
+    if (profile_cgroup_join(&arguments.profile))
+    {
+        exit(1);
+    }
+
     /* app_to_run == argv[copy_args_from] */
-    return execv(arguments.app_to_run, argv + arguments.copy_args_from);
+    arguments_exec(&arguments, argv + arguments.copy_args_from);
+    return 1;
 }
\ No newline at end of file